@@ -4,8 +4,14 @@
 
 // Factory method: Constructs a single object, abstract factory constructs 
 // multiple objects.
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
 
 enum class OS_TYPE
 {
@@ -83,6 +89,7 @@ public:
             return std::make_unique<WindowsDialogBox>(numButtons);
         else if (osType == OS_TYPE::MAC)
             return std::make_unique<MacOSDialogBox>(numButtons);
+        return nullptr;
     }
 };
 
@@ -95,6 +102,7 @@ public:
             return std::make_unique<WindowsMenu>(numOptions);
         else if (osType == OS_TYPE::MAC)
             return std::make_unique<MacOSMenu>(numOptions);
+        return nullptr;
     }
 };
 
@@ -123,6 +131,230 @@ private:
     DialogBoxFactory dbf;
 };
 
+// Flat layout format.
+// Large layouts are persisted as one contiguous buffer that can be read in
+// place (e.g. straight out of an mmap'd file) without deserializing anything.
+// The buffer is a FlatUIHeader followed by numElements FlatUIElement records.
+// Elements are stored breadth first, so the roots are [0, numRoots) and the
+// children of an element are the contiguous range
+// [firstChild, firstChild + numChildren). All fields are fixed width, in the
+// host's byte order and index based, nothing in the buffer is a pointer.
+enum class UI_ELEMENT_TYPE : uint8_t
+{
+    NONE = 0,
+    DIALOG_BOX = 1,
+    MENU = 2
+};
+
+struct FlatUIHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t numElements;
+    uint32_t numRoots;
+};
+
+struct FlatUIElement
+{
+    uint32_t parent;
+    uint32_t firstChild;
+    uint32_t numChildren;
+    int32_t count; // Number of buttons or menu options.
+    uint8_t type;
+    uint8_t osType;
+    uint16_t reserved;
+};
+
+static_assert(sizeof(FlatUIHeader) == 16, "FlatUIHeader must be packed.");
+static_assert(sizeof(FlatUIElement) == 20, "FlatUIElement must be packed.");
+
+constexpr char FLAT_UI_MAGIC[4] = { 'D', 'P', 'U', 'I' };
+constexpr uint32_t FLAT_UI_VERSION = 1;
+constexpr uint32_t FLAT_UI_NO_PARENT = 0xFFFFFFFF;
+
+// Builds a layout tree in memory and writes it out in the flat format.
+class FlatUILayoutBuilder
+{
+public:
+    // Returns the id of the new element, to be used as a parent for others.
+    uint32_t add(UI_ELEMENT_TYPE type, OS_TYPE osType, int count,
+        uint32_t parent = FLAT_UI_NO_PARENT)
+    {
+        if (parent != FLAT_UI_NO_PARENT && parent >= m_nodes.size())
+            throw std::out_of_range("FlatUILayoutBuilder: invalid parent.");
+
+        uint32_t id = static_cast<uint32_t>(m_nodes.size());
+        m_nodes.push_back({ type, osType, count, {} });
+        if (parent == FLAT_UI_NO_PARENT)
+            m_roots.push_back(id);
+        else
+            m_nodes[parent].children.push_back(id);
+        return id;
+    }
+
+    std::vector<char> serialize() const
+    {
+        // Breadth first order keeps every sibling group contiguous.
+        std::vector<uint32_t> order(m_roots);
+        std::vector<uint32_t> newIndex(m_nodes.size());
+        order.reserve(m_nodes.size());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            newIndex[order[i]] = static_cast<uint32_t>(i);
+            for (auto child : m_nodes[order[i]].children)
+                order.push_back(child);
+        }
+
+        FlatUIHeader header;
+        std::memcpy(header.magic, FLAT_UI_MAGIC, sizeof(header.magic));
+        header.version = FLAT_UI_VERSION;
+        header.numElements = static_cast<uint32_t>(order.size());
+        header.numRoots = static_cast<uint32_t>(m_roots.size());
+
+        std::vector<char> buffer(sizeof(FlatUIHeader) +
+            order.size() * sizeof(FlatUIElement));
+        std::memcpy(buffer.data(), &header, sizeof(header));
+
+        char *out = buffer.data() + sizeof(FlatUIHeader);
+        uint32_t nextChild = header.numRoots;
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            const Node &node = m_nodes[order[i]];
+            FlatUIElement element{};
+            element.parent = FLAT_UI_NO_PARENT;
+            element.firstChild = nextChild;
+            element.numChildren = static_cast<uint32_t>(node.children.size());
+            element.count = node.count;
+            element.type = static_cast<uint8_t>(node.type);
+            element.osType = static_cast<uint8_t>(node.osType);
+            nextChild += element.numChildren;
+            std::memcpy(out + i * sizeof(FlatUIElement), &element,
+                sizeof(element));
+        }
+
+        // Parents are only known once every element has a final index.
+        for (size_t i = 0; i < m_nodes.size(); ++i)
+        {
+            for (auto child : m_nodes[i].children)
+            {
+                std::memcpy(out + newIndex[child] * sizeof(FlatUIElement) +
+                    offsetof(FlatUIElement, parent), &newIndex[i],
+                    sizeof(uint32_t));
+            }
+        }
+        return buffer;
+    }
+
+private:
+    struct Node
+    {
+        UI_ELEMENT_TYPE type;
+        OS_TYPE osType;
+        int count;
+        std::vector<uint32_t> children;
+    };
+
+    std::vector<Node> m_nodes;
+    std::vector<uint32_t> m_roots;
+};
+
+// A read only view over a flat layout buffer. It does not copy or own the
+// buffer, so the memory (e.g. an mmap'd file) must outlive the view.
+class FlatUILayout
+{
+public:
+    FlatUILayout(const void *data, size_t size)
+        : m_data(static_cast<const char*>(data))
+    {
+        if (size < sizeof(FlatUIHeader))
+            throw std::runtime_error("FlatUILayout: buffer too small.");
+        std::memcpy(&m_header, m_data, sizeof(m_header));
+        if (std::memcmp(m_header.magic, FLAT_UI_MAGIC, 4) != 0 ||
+            m_header.version != FLAT_UI_VERSION)
+            throw std::runtime_error("FlatUILayout: unsupported format.");
+        if ((size - sizeof(FlatUIHeader)) / sizeof(FlatUIElement) <
+            m_header.numElements || m_header.numRoots > m_header.numElements)
+            throw std::runtime_error("FlatUILayout: truncated buffer.");
+    }
+
+    uint32_t size() const { return m_header.numElements; }
+    uint32_t numRoots() const { return m_header.numRoots; }
+
+    // Elements are copied out rather than referenced since the buffer may not
+    // be suitably aligned.
+    FlatUIElement element(uint32_t index) const
+    {
+        if (index >= m_header.numElements)
+            throw std::out_of_range("FlatUILayout: invalid element.");
+        FlatUIElement element;
+        std::memcpy(&element, m_data + sizeof(FlatUIHeader) +
+            size_t(index) * sizeof(FlatUIElement), sizeof(element));
+        if (element.firstChild > m_header.numElements ||
+            element.numChildren > m_header.numElements - element.firstChild)
+            throw std::runtime_error("FlatUILayout: corrupt element.");
+        return element;
+    }
+
+private:
+    const char *m_data;
+    FlatUIHeader m_header;
+};
+
+// Materializes the concrete UI elements of a flat layout on demand. Nothing is
+// constructed until an element is first accessed, so loading a huge layout
+// costs the same as loading an empty one.
+class LazyUILayout
+{
+public:
+    LazyUILayout(FlatUILayout layout) : m_layout(layout) {}
+
+    const FlatUILayout& layout() const { return m_layout; }
+
+    // Returns nullptr if the element is not a dialog box.
+    IDialogBox* dialogBox(uint32_t index)
+    {
+        auto found = m_dialogBoxes.find(index);
+        if (found != m_dialogBoxes.end())
+            return found->second.get();
+
+        FlatUIElement element = m_layout.element(index);
+        if (element.type != static_cast<uint8_t>(UI_ELEMENT_TYPE::DIALOG_BOX))
+            return nullptr;
+        auto &db = m_dialogBoxes[index];
+        db = m_dbf.createDialogBox(static_cast<OS_TYPE>(element.osType),
+            element.count);
+        return db.get();
+    }
+
+    // Returns nullptr if the element is not a menu.
+    IMenu* menu(uint32_t index)
+    {
+        auto found = m_menus.find(index);
+        if (found != m_menus.end())
+            return found->second.get();
+
+        FlatUIElement element = m_layout.element(index);
+        if (element.type != static_cast<uint8_t>(UI_ELEMENT_TYPE::MENU))
+            return nullptr;
+        auto &menu = m_menus[index];
+        menu = m_mf.createMenu(static_cast<OS_TYPE>(element.osType),
+            element.count);
+        return menu.get();
+    }
+
+    size_t numMaterialized() const
+    {
+        return m_dialogBoxes.size() + m_menus.size();
+    }
+
+private:
+    FlatUILayout m_layout;
+    DialogBoxFactory m_dbf;
+    MenuFactory m_mf;
+    std::unordered_map<uint32_t, std::unique_ptr<IDialogBox>> m_dialogBoxes;
+    std::unordered_map<uint32_t, std::unique_ptr<IMenu>> m_menus;
+};
+
 inline void AbstractFactoryDemo()
 {
     int temp = 0;
@@ -0,0 +1,1370 @@
+// Microbenchmarks for the hot paths of every pattern. Built by CMake as
+// DesignPatternsBench, run with --help for the options. Results are printed as
+// a table and can be exported as JSON to track regressions over time.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "Strategy.h"
+#include "Observer.h"
+#include "FactoryMethod.h"
+#include "AbstractFactory.h"
+#include "Command.h"
+#include "Proxy.h"
+#include "ProtectionProxy.h"
+#include "RemoteProxy.h"
+#include "SharedObserver.h"
+#include "Bridge.h"
+#include "Singleton.h"
+#include "Log.h"
+#include "Trace.h"
+
+// Every heap allocation is counted, so benchmarks can report allocations per
+// operation alongside their timings.
+static std::atomic<uint64_t> g_allocations{ 0 };
+
+void* operator new(size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *memory = std::malloc(size == 0 ? 1 : size))
+        return memory;
+    throw std::bad_alloc();
+}
+
+// GCC inlines these into callers, sees free() given a pointer that came
+// from operator new, and warns, not knowing that this operator new is
+// malloc(). The pairing is correct, so the warning is silenced here only.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void *memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept
+{
+    std::free(memory);
+}
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+// Keeps the compiler from optimizing away a result nobody reads, or from
+// hoisting the work that produced it out of the benchmark loop.
+template <typename T>
+void doNotOptimize(const T &value)
+{
+#if defined(__GNUC__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void *sink;
+    sink = &value;
+    _ReadWriteBarrier();
+#endif
+}
+
+struct BenchmarkResult
+{
+    std::string name;
+    uint64_t iterations;
+    double seconds;
+    std::vector<std::pair<std::string, double>> metrics;
+
+    double nsPerOp() const
+    {
+        return iterations == 0 ? 0.0 : seconds * 1e9 / double(iterations);
+    }
+
+    BenchmarkResult& metric(const std::string &key, double value)
+    {
+        metrics.emplace_back(key, value);
+        return *this;
+    }
+};
+
+struct BenchmarkOptions
+{
+    std::string filter;
+    std::string jsonPath;
+    std::string tracePath;
+    double minSeconds{ 0.2 };
+    bool large{ false };
+};
+
+class BenchmarkSuite
+{
+public:
+    BenchmarkSuite(BenchmarkOptions options) : m_options(std::move(options)) {}
+
+    bool enabled(const std::string &name) const
+    {
+        return m_options.filter.empty() ||
+            name.find(m_options.filter) != std::string::npos;
+    }
+
+    // For setup shared by a group of benchmarks, which is skipped when none
+    // of them is going to run.
+    bool anyEnabled(const std::vector<std::string> &names) const
+    {
+        return std::any_of(names.begin(), names.end(),
+            [this](const std::string &name) { return enabled(name); });
+    }
+
+    bool large() const { return m_options.large; }
+
+    // body(n) must perform the measured operation n times. The iteration
+    // count grows until a run takes at least the minimum time.
+    BenchmarkResult* run(const std::string &name,
+        const std::function<void(uint64_t)> &body)
+    {
+        if (!enabled(name))
+            return nullptr;
+
+        uint64_t iterations = 1;
+        for (;;)
+        {
+            uint64_t allocations = g_allocations.load();
+            double seconds = time([&]() { body(iterations); });
+            allocations = g_allocations.load() - allocations;
+            if (seconds >= m_options.minSeconds || iterations >= (1ull << 40))
+            {
+                auto &result = add(name, iterations, seconds);
+                result.metric("allocs_per_op",
+                    double(allocations) / double(iterations));
+                return &result;
+            }
+            double scale = seconds <= 0.0 ? 100.0 :
+                std::min(100.0, 1.4 * m_options.minSeconds / seconds);
+            iterations = std::max(iterations + 1,
+                uint64_t(double(iterations) * scale));
+        }
+    }
+
+    // For things that only make sense once, like a first access.
+    BenchmarkResult* once(const std::string &name,
+        const std::function<void()> &body)
+    {
+        if (!enabled(name))
+            return nullptr;
+        return &add(name, 1, time(body));
+    }
+
+    static double time(const std::function<void()> &body)
+    {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        return std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Records a failed correctness check, which makes the run exit with 1.
+    void fail(const std::string &message)
+    {
+        std::fprintf(stderr, "FAILED %s\n", message.c_str());
+        m_failed = true;
+    }
+
+    bool failed() const { return m_failed; }
+
+    void report() const
+    {
+        std::printf("%-48s %14s %14s  %s\n", "benchmark", "iterations",
+            "ns/op", "metrics");
+        for (auto &result : m_results)
+        {
+            std::printf("%-48s %14llu %14.1f ", result.name.c_str(),
+                static_cast<unsigned long long>(result.iterations),
+                result.nsPerOp());
+            for (auto &metric : result.metrics)
+                std::printf(" %s=%.4g", metric.first.c_str(), metric.second);
+            std::printf("\n");
+        }
+    }
+
+    bool writeJson() const
+    {
+        if (m_options.jsonPath.empty())
+            return true;
+        std::ofstream out(m_options.jsonPath);
+        out << "{\n  \"context\": {\"hardware_threads\": "
+            << std::thread::hardware_concurrency()
+            << ", \"min_seconds\": " << m_options.minSeconds
+            << "},\n  \"benchmarks\": [";
+        for (size_t i = 0; i < m_results.size(); ++i)
+        {
+            auto &result = m_results[i];
+            out << (i == 0 ? "\n" : ",\n") << "    {\"name\": \""
+                << result.name << "\", \"iterations\": " << result.iterations
+                << ", \"seconds\": " << result.seconds
+                << ", \"ns_per_op\": " << result.nsPerOp()
+                << ", \"metrics\": {";
+            for (size_t m = 0; m < result.metrics.size(); ++m)
+            {
+                double value = result.metrics[m].second;
+                out << (m == 0 ? "" : ", ") << "\""
+                    << result.metrics[m].first << "\": "
+                    << (std::isfinite(value) ? value : 0.0);
+            }
+            out << "}}";
+        }
+        out << "\n  ]\n}\n";
+        return static_cast<bool>(out);
+    }
+
+private:
+    BenchmarkResult& add(const std::string &name, uint64_t iterations,
+        double seconds)
+    {
+        m_results.push_back({ name, iterations, seconds, {} });
+        return m_results.back();
+    }
+
+    BenchmarkOptions m_options;
+    // A deque, so the results handed out by run() and once() stay valid
+    // while later benchmarks are added.
+    std::deque<BenchmarkResult> m_results;
+    bool m_failed{ false };
+};
+
+// The current resident set, and the part of it that is private to the
+// process rather than backed by a file (such as a mapped book). Only read on
+// Linux; zero elsewhere.
+struct ResidentMemory
+{
+    double totalMb;
+    double privateMb;
+};
+
+static ResidentMemory residentMemory()
+{
+    ResidentMemory memory{ 0.0, 0.0 };
+#ifdef __linux__
+    std::ifstream statm("/proc/self/statm");
+    unsigned long long size = 0, resident = 0, shared = 0;
+    if (statm >> size >> resident >> shared)
+    {
+        double pageMb = double(sysconf(_SC_PAGESIZE)) / (1024.0 * 1024.0);
+        memory.totalMb = double(resident) * pageMb;
+        memory.privateMb = double(resident - shared) * pageMb;
+    }
+#endif
+    return memory;
+}
+
+// A synthetic book: 60 character lines and a form feed every 10000 lines.
+static std::string makeBook(size_t size)
+{
+    std::string book(size, 'a');
+    for (size_t i = 59; i < size; i += 60)
+        book[i] = (i / 60) % 10000 == 9999 ? '\f' : '\n';
+    return book;
+}
+
+static std::string tempPath(const std::string &name)
+{
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+// Samples ranks 0..n-1 with probability proportional to 1 / (rank + 1)^s.
+class ZipfGenerator
+{
+public:
+    ZipfGenerator(size_t n, double s, uint32_t seed) : m_random(seed)
+    {
+        double sum = 0.0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            sum += 1.0 / std::pow(double(i + 1), s);
+            m_cdf.push_back(sum);
+        }
+        for (auto &value : m_cdf)
+            value /= sum;
+    }
+
+    size_t next()
+    {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(m_random);
+        return std::lower_bound(m_cdf.begin(), m_cdf.end(), u) -
+            m_cdf.begin();
+    }
+
+private:
+    std::mt19937 m_random;
+    std::vector<double> m_cdf;
+};
+
+static void benchStrategy(BenchmarkSuite &suite)
+{
+    SimpleQuack sq;
+    SimpleFly sf;
+    NoQuack nq;
+    NoFly nf;
+    Duck typicalDuck(sq, sf);
+    Duck rubberDuck(nq, nf);
+    suite.run("strategy/duck_quack_fly", [&](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            Duck &duck = (i & 1) ? typicalDuck : rubberDuck;
+            duck.quack();
+            duck.fly();
+        }
+    });
+}
+
+#ifndef _WIN32
+struct SubscriberReport
+{
+    uint64_t updates;
+    uint64_t latencyNs;
+    uint64_t errors;
+    int32_t lastTemperature;
+};
+
+// Runs in a forked subscriber process until it reads stopTemperature. Every
+// reading is checked against the publisher's numbering: publish k carries
+// temperature k and sequence 2k + 2 (the publisher's own first publish is
+// sequence 2), so a torn read or a sequence going
+// backwards is counted as an error.
+[[noreturn]] static void runSubscriberProcess(const std::string &name,
+    int stopTemperature, int readyFd, int reportFd)
+{
+    SubscriberReport report{};
+    try
+    {
+        SharedWeatherSubscriber subscriber(name);
+        char ready = 1;
+        if (write(readyFd, &ready, 1) != 1)
+            _exit(2);
+        WeatherReading reading;
+        uint64_t lastSequence = 0;
+        while (report.lastTemperature != stopTemperature)
+        {
+            if (!subscriber.waitForUpdate(reading, std::chrono::seconds(10)))
+                _exit(3);
+            ++report.updates;
+            report.latencyNs += uint64_t(shared_weather_detail::nowNs() -
+                reading.publishedAtNs);
+            if (reading.sequence <= lastSequence || (reading.sequence > 2 &&
+                reading.sequence != 2 * uint64_t(reading.temperature) + 2))
+                ++report.errors;
+            lastSequence = reading.sequence;
+            report.lastTemperature = reading.temperature;
+        }
+    }
+    catch (...)
+    {
+        _exit(4);
+    }
+    _exit(write(reportFd, &report, sizeof(report)) == sizeof(report) ? 0 : 5);
+}
+
+// Publishes numPublishes updates to subscribers in separate processes, the
+// way the segment is meant to be used, and checks what each of them saw.
+static void benchSharedObserver(BenchmarkSuite &suite, int numSubscribers,
+    int numPublishes, std::chrono::microseconds pace)
+{
+    std::string name = "observer/shm_" + std::to_string(numSubscribers) +
+        "_processes_" + (pace.count() > 0 ? "paced" : "flat_out");
+    if (!suite.enabled(name))
+        return;
+
+    const std::string segment = "/dp_bench_weather";
+    const int stopTemperature = numPublishes + 1;
+    WeatherStationObservable wso;
+    SharedWeatherPublisher publisher(segment, wso);
+    int readyPipe[2];
+    int reportPipe[2];
+    if (pipe(readyPipe) != 0 || pipe(reportPipe) != 0)
+    {
+        suite.fail(name + ": pipe failed");
+        return;
+    }
+
+    std::vector<pid_t> children;
+    for (int i = 0; i < numSubscribers; ++i)
+    {
+        std::fflush(nullptr);
+        pid_t child = fork();
+        if (child == 0)
+        {
+            runSubscriberProcess(segment, stopTemperature, readyPipe[1],
+                reportPipe[1]);
+        }
+        if (child > 0)
+            children.push_back(child);
+    }
+    close(readyPipe[1]);
+    close(reportPipe[1]);
+    for (size_t i = 0; i < children.size(); ++i)
+    {
+        char ready;
+        if (read(readyPipe[0], &ready, 1) != 1)
+            break;
+    }
+
+    double seconds = BenchmarkSuite::time([&]()
+    {
+        for (int k = 1; k <= numPublishes; ++k)
+        {
+            publisher.publish(k);
+            if (pace.count() > 0)
+                std::this_thread::sleep_for(pace);
+        }
+    });
+    publisher.publish(stopTemperature);
+
+    SubscriberReport total{};
+    int reports = 0;
+    SubscriberReport report;
+    while (read(reportPipe[0], &report, sizeof(report)) == sizeof(report))
+    {
+        total.updates += report.updates;
+        total.latencyNs += report.latencyNs;
+        total.errors += report.errors;
+        ++reports;
+    }
+    int exited = 0;
+    for (pid_t child : children)
+    {
+        int status = 0;
+        if (waitpid(child, &status, 0) == child && WIFEXITED(status) &&
+            WEXITSTATUS(status) == 0)
+            ++exited;
+    }
+    close(readyPipe[0]);
+    close(reportPipe[0]);
+
+    if (exited != numSubscribers || reports != numSubscribers ||
+        total.errors != 0)
+    {
+        suite.fail(name + ": " + std::to_string(exited) + " of " +
+            std::to_string(numSubscribers) + " subscribers finished, " +
+            std::to_string(total.errors) + " inconsistent readings");
+    }
+    auto result = suite.once(name, []() {});
+    if (result)
+    {
+        result->iterations = uint64_t(numPublishes);
+        result->seconds = seconds;
+        result->metric("publishes_per_s", double(numPublishes) / seconds);
+        if (total.updates > 0)
+        {
+            result->metric("mean_latency_ns",
+                double(total.latencyNs) / double(total.updates));
+        }
+        result->metric("updates_seen_per_subscriber",
+            double(total.updates) / double(numSubscribers));
+    }
+}
+#endif
+
+static void benchObserver(BenchmarkSuite &suite)
+{
+    for (size_t numObservers : { 1, 16, 256 })
+    {
+        WeatherStationObservable wso;
+        std::vector<std::unique_ptr<PhoneDisplayObserver>> observers;
+        for (size_t i = 0; i < numObservers; ++i)
+        {
+            observers.push_back(std::make_unique<PhoneDisplayObserver>(wso));
+            wso.add(*observers.back());
+        }
+        auto result = suite.run("observer/notify_fanout_" +
+            std::to_string(numObservers), [&](uint64_t n)
+        {
+            for (uint64_t i = 0; i < n; ++i)
+            {
+                int temperature = static_cast<int>(i & 1);
+                wso.setTemperature(temperature);
+            }
+        });
+        if (result)
+        {
+            result->metric("ns_per_observer",
+                result->nsPerOp() / double(numObservers));
+        }
+    }
+
+#ifndef _WIN32
+    for (int numSubscribers : { 1, 4, 16, 64 })
+    {
+        // Paced, so every update is seen and the latency is that of a single
+        // update, then flat out for throughput.
+        benchSharedObserver(suite, numSubscribers, 2000,
+            std::chrono::microseconds(50));
+        benchSharedObserver(suite, numSubscribers,
+            std::max(2000, 200000 / numSubscribers),
+            std::chrono::microseconds(0));
+    }
+#endif
+}
+
+static void benchFactories(BenchmarkSuite &suite)
+{
+    ObstacleFactory of;
+    suite.run("factory_method/create_obstacle", [&](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+            doNotOptimize(of.createObstacle(static_cast<int>(i & 3)));
+    });
+
+    UserInterfaceFactory uif(OS_TYPE::WINDOWS);
+    suite.run("abstract_factory/create_dialog_and_menu", [&](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            uif.setOSType((i & 1) ? OS_TYPE::MAC : OS_TYPE::WINDOWS);
+            doNotOptimize(uif.createDialogbox(2));
+            doNotOptimize(uif.createMenu(3));
+        }
+    });
+
+    const uint32_t numElements = suite.large() ? 1000000 : 100000;
+    std::string name = "abstract_factory/flat_layout_load_to_first_render_" +
+        std::to_string(numElements);
+    if (!suite.enabled(name))
+        return;
+
+    FlatUILayoutBuilder builder;
+    uint32_t window = FLAT_UI_NO_PARENT;
+    for (uint32_t i = 0; i < numElements; ++i)
+    {
+        if (i % 1000 == 0)
+        {
+            window = builder.add(UI_ELEMENT_TYPE::DIALOG_BOX, OS_TYPE::WINDOWS,
+                static_cast<int>(i % 7));
+        }
+        else
+        {
+            builder.add(UI_ELEMENT_TYPE::MENU, OS_TYPE::MAC,
+                static_cast<int>(i % 5), window);
+        }
+    }
+    std::string path = tempPath("dp_bench_layout.bin");
+    {
+        auto buffer = builder.serialize();
+        std::ofstream out(path, std::ios::binary);
+        out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    }
+
+    size_t materialized = 0;
+    auto result = suite.once(name, [&]()
+    {
+        MappedFile file(path);
+        LazyUILayout layout(FlatUILayout(file.view().data(),
+            file.view().size()));
+        layout.dialogBox(0)->printContents();
+        materialized = layout.numMaterialized();
+    });
+    if (result)
+        result->metric("elements_materialized", double(materialized));
+    std::filesystem::remove(path);
+}
+
+static void benchCommand(BenchmarkSuite &suite)
+{
+    Car car;
+    RemoteControlA rc;
+    rc.setButtonA(std::make_unique<TurnCarOn>(&car));
+    rc.setButtonB(std::make_unique<MoveCarLeft>(&car));
+    rc.setButtonC(std::make_unique<LockCarDoors>(&car));
+    suite.run("command/execute_undo", [&](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            switch (i % 3)
+            {
+            case 0: rc.pressButtonA(); break;
+            case 1: rc.pressButtonB(); break;
+            default: rc.pressButtonC(); break;
+            }
+            rc.undoLastCommand();
+        }
+    });
+}
+
+// Counts BookParser constructions, each of which logs this line once.
+class ConstructionCountingSink : public ILogSink
+{
+public:
+    void write(std::string_view line) override
+    {
+        if (line == "This is a very expensive constructor initialization.")
+            m_constructions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t constructions() const
+    {
+        return m_constructions.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> m_constructions{ 0 };
+};
+
+// Many threads released at once onto the first getNumPages() of a fresh
+// ConcurrentLazyBookParserProxy. Exactly one of them may build the parser,
+// and all of them must see its result.
+static void checkConcurrentFirstAccess(BenchmarkSuite &suite)
+{
+    const std::string name = "proxy/concurrent_first_access_64_threads";
+    if (!suite.enabled(name))
+        return;
+
+    const unsigned numThreads = 64;
+    const int rounds = 50;
+    // Big enough that the parse outlasts a scheduler time slice, so the
+    // threads also pile up on the first call on a single core.
+    auto book = BookSource::fromString(makeBook(8 << 20));
+    const int expected = BookParser(book->view()).getNumPages();
+
+    ConstructionCountingSink counter;
+    ILogSink &previous = logSink();
+    setLogSink(counter);
+    uint64_t wrongResults = 0;
+    auto result = suite.once(name, [&]()
+    {
+        for (int round = 0; round < rounds; ++round)
+        {
+            ConcurrentLazyBookParserProxy proxy(book);
+            std::atomic<unsigned> ready{ 0 };
+            std::atomic<bool> go{ false };
+            std::atomic<uint64_t> wrong{ 0 };
+            std::vector<std::thread> threads;
+            for (unsigned t = 0; t < numThreads; ++t)
+            {
+                threads.emplace_back([&]()
+                {
+                    ready.fetch_add(1);
+                    while (!go.load(std::memory_order_acquire))
+                        std::this_thread::yield();
+                    if (proxy.getNumPages() != expected)
+                        wrong.fetch_add(1);
+                });
+            }
+            while (ready.load() != numThreads)
+                std::this_thread::yield();
+            go.store(true, std::memory_order_release);
+            for (auto &thread : threads)
+                thread.join();
+            wrongResults += wrong.load();
+        }
+    });
+    setLogSink(previous);
+
+    if (counter.constructions() != uint64_t(rounds) || wrongResults != 0)
+    {
+        suite.fail(name + ": " + std::to_string(counter.constructions()) +
+            " constructions for " + std::to_string(rounds) + " proxies, " +
+            std::to_string(wrongResults) + " wrong page counts");
+    }
+    if (result)
+    {
+        result->iterations = rounds;
+        result->metric("constructions_per_proxy",
+            double(counter.constructions()) / rounds);
+    }
+}
+
+static void benchLazyProxies(BenchmarkSuite &suite)
+{
+    const std::string firstAccess = "proxy/virtual_first_access_16MB";
+    const std::string warmAccess = "proxy/virtual_warm_access";
+    std::vector<std::string> latencyNames;
+    for (bool hint : { false, true })
+    {
+        latencyNames.push_back(std::string("proxy/first_call_latency_") +
+            (hint ? "with_prefetch" : "without_prefetch"));
+    }
+    const std::vector<unsigned> threadCounts = { 1u, 8u, 64u };
+    std::vector<std::string> concurrentNames;
+    for (unsigned numThreads : threadCounts)
+    {
+        concurrentNames.push_back("proxy/concurrent_warm_access_" +
+            std::to_string(numThreads) + "_threads");
+    }
+    std::vector<std::string> names = { firstAccess, warmAccess };
+    names.insert(names.end(), latencyNames.begin(), latencyNames.end());
+    names.insert(names.end(), concurrentNames.begin(), concurrentNames.end());
+    if (!suite.anyEnabled(names))
+        return;
+
+    const size_t bookSize = 16 << 20;
+    auto book = BookSource::fromString(makeBook(bookSize));
+
+    suite.run(firstAccess, [&](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            LazyBookParserProxy proxy(book);
+            doNotOptimize(proxy.getNumPages());
+        }
+    });
+
+    if (suite.enabled(warmAccess))
+    {
+        LazyBookParserProxy warm(book);
+        warm.getNumPages();
+        suite.run(warmAccess, [&](uint64_t n)
+        {
+            for (uint64_t i = 0; i < n; ++i)
+                doNotOptimize(warm.getNumPages());
+        });
+    }
+
+    // The caller does 5 ms of other work between the hint and the call.
+    for (bool hint : { false, true })
+    {
+        const std::string &name = latencyNames[hint ? 1 : 0];
+        double total = 0.0;
+        const int rounds = 20;
+        for (int round = 0; round < rounds && suite.enabled(name); ++round)
+        {
+            LazyBookParserProxy proxy(book);
+            if (hint)
+                proxy.prefetch();
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            total += BenchmarkSuite::time([&]() {
+                doNotOptimize(proxy.getNumPages()); });
+        }
+        auto result = suite.once(name, []() {});
+        if (result)
+        {
+            result->iterations = rounds;
+            result->seconds = total;
+        }
+    }
+
+    if (!suite.anyEnabled(concurrentNames))
+        return;
+    ConcurrentLazyBookParserProxy shared(book);
+    shared.getNumPages();
+    for (size_t i = 0; i < threadCounts.size(); ++i)
+    {
+        unsigned numThreads = threadCounts[i];
+        auto result = suite.run(concurrentNames[i], [&](uint64_t n)
+        {
+            std::vector<std::thread> threads;
+            for (unsigned t = 0; t < numThreads; ++t)
+            {
+                threads.emplace_back([&]()
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                        doNotOptimize(shared.getNumPages());
+                });
+            }
+            for (auto &thread : threads)
+                thread.join();
+        });
+        if (result)
+            result->metric("reads_per_op", double(numThreads));
+    }
+}
+
+// 1000 distinct books requested with a Zipfian skew, through a cache that
+// can only hold a tenth of them.
+static void benchCachedProxy(BenchmarkSuite &suite)
+{
+    if (!suite.enabled("proxy/cached_zipf"))
+        return;
+
+    std::vector<std::shared_ptr<const BookSource>> books;
+    for (int i = 0; i < 1000; ++i)
+    {
+        books.push_back(BookSource::fromString(makeBook(4096) +
+            std::to_string(i)));
+    }
+    BookParserCache cache(100 * BookParserCache::entryBytes(), 4);
+    ZipfGenerator zipf(books.size(), 0.99, 42);
+    std::vector<size_t> requests(1 << 16);
+    for (auto &request : requests)
+        request = zipf.next();
+
+    auto result = suite.run("proxy/cached_zipf", [&](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            CachedBookParserProxy proxy(
+                books[requests[i & (requests.size() - 1)]], cache);
+            doNotOptimize(proxy.getNumPages());
+        }
+    });
+    if (result)
+    {
+        auto stats = cache.stats();
+        result->metric("hit_rate", double(stats.hits) /
+            double(stats.hits + stats.misses));
+        result->metric("evictions", double(stats.evictions));
+    }
+}
+
+// Page counting throughput for each engine, and the cost of building a proxy
+// over a large book from a mapped file, an index or a string copy.
+static void benchPageCounting(BenchmarkSuite &suite)
+{
+    const size_t scanSize = suite.large() ? (size_t(1) << 30) : (64 << 20);
+    std::string scanLabel = std::to_string(scanSize >> 20) + "MB";
+    const std::vector<std::string> countNames = {
+        "proxy/page_count_scalar_" + scanLabel,
+        "proxy/page_count_simd_" + scanLabel,
+        "proxy/page_count_parallel_" + scanLabel };
+    const std::vector<std::string> constructNames = {
+        "proxy/construct_from_mapped_file_" + scanLabel,
+        "proxy/construct_from_indexed_file_" + scanLabel,
+        "proxy/construct_from_string_copy_" + scanLabel };
+    bool counting = suite.anyEnabled(countNames);
+    bool constructing = suite.anyEnabled(constructNames);
+    if (!counting && !constructing)
+        return;
+
+    std::string scanBook = makeBook(scanSize);
+    auto gbPerSecond = [&](BenchmarkResult *result)
+    {
+        if (result)
+        {
+            result->metric("GB_per_s", double(scanSize) * 1e-9 /
+                (result->seconds / double(result->iterations)));
+        }
+    };
+    gbPerSecond(suite.run(countNames[0], [&](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            PageCounter counter;
+            counter.merge(PageCounter::scan(scanBook, false));
+            doNotOptimize(counter.numPages());
+        }
+    }));
+    gbPerSecond(suite.run(countNames[1], [&](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            PageCounter counter;
+            counter.merge(PageCounter::scan(scanBook));
+            doNotOptimize(counter.numPages());
+        }
+    }));
+    gbPerSecond(suite.run(countNames[2], [&](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+            doNotOptimize(PageCounter::countPages(scanBook));
+    }));
+    if (!constructing)
+        return;
+
+    // Building a proxy from a string copies the book once, building it from
+    // a mapped file copies nothing. Memory is sampled while each proxy is
+    // still alive, against a sample taken just before it was built.
+    std::string bookPath = tempPath("dp_bench_book.txt");
+    {
+        std::ofstream out(bookPath, std::ios::binary);
+        out.write(scanBook.data(), static_cast<std::streamsize>(scanSize));
+    }
+    scanBook = std::string();
+    std::filesystem::remove(BookIndex::pathFor(bookPath));
+    ResidentMemory before{}, during{};
+    auto recordGrowth = [&](BenchmarkResult *result)
+    {
+        if (!result)
+            return;
+        result->metric("rss_growth_MB", during.totalMb - before.totalMb);
+        result->metric("private_rss_growth_MB",
+            during.privateMb - before.privateMb);
+    };
+    recordGrowth(suite.once(constructNames[0], [&]()
+    {
+        before = residentMemory();
+        LazyBookParserProxy proxy(BookSource::fromFile(bookPath));
+        doNotOptimize(proxy.getNumPages());
+        during = residentMemory();
+    }));
+
+    auto indexed = suite.once(constructNames[1], [&]()
+    {
+        LazyBookParserProxy proxy(BookSource::fromFile(bookPath));
+        doNotOptimize(proxy.getNumPages());
+    });
+    if (indexed)
+        indexed->metric("index_valid", std::filesystem::exists(
+            BookIndex::pathFor(bookPath)) ? 1.0 : 0.0);
+
+    recordGrowth(suite.once(constructNames[2], [&]()
+    {
+        before = residentMemory();
+        std::ifstream in(bookPath, std::ios::binary);
+        std::string contents((std::istreambuf_iterator<char>(in)),
+            std::istreambuf_iterator<char>());
+        LazyBookParserProxy proxy(std::move(contents));
+        doNotOptimize(proxy.getNumPages());
+        during = residentMemory();
+    }));
+    std::filesystem::remove(bookPath);
+    std::filesystem::remove(BookIndex::pathFor(bookPath));
+}
+
+// Cold start of a corpus of small books, with and without indexes.
+static void benchCorpus(BenchmarkSuite &suite)
+{
+    const int corpusSize = suite.large() ? 10000 : 1000;
+    std::string corpusName = "proxy/corpus_cold_start_" +
+        std::to_string(corpusSize) + "_books";
+    if (!suite.anyEnabled({ corpusName + "_unindexed",
+        corpusName + "_indexed" }))
+        return;
+
+    auto corpus = std::filesystem::temp_directory_path() / "dp_bench_corpus";
+    std::filesystem::create_directories(corpus);
+    std::string contents = makeBook(64 * 1024);
+    std::vector<std::string> paths;
+    for (int i = 0; i < corpusSize; ++i)
+    {
+        paths.push_back((corpus / (std::to_string(i) + ".txt")).string());
+        std::ofstream out(paths.back(), std::ios::binary);
+        out << contents << i;
+    }
+    // The indexed run relies on the unindexed one having written the
+    // indexes, so both always run.
+    for (bool withIndex : { false, true })
+    {
+        std::string name = corpusName + (withIndex ?
+            "_indexed" : "_unindexed");
+        double seconds = BenchmarkSuite::time([&]()
+        {
+            for (auto &path : paths)
+            {
+                LazyBookParserProxy proxy(BookSource::fromFile(path));
+                doNotOptimize(proxy.getNumPages());
+            }
+        });
+        auto result = suite.once(name, []() {});
+        if (result)
+        {
+            result->iterations = paths.size();
+            result->seconds = seconds;
+        }
+    }
+    std::filesystem::remove_all(corpus);
+}
+
+// Protection proxy overhead on top of calling the parser directly. A warm
+// call does not depend on the size of the book.
+static void benchProtectionProxy(BenchmarkSuite &suite)
+{
+    if (!suite.anyEnabled({ "proxy/protection_direct_call",
+        "proxy/protection_cached_check" }))
+        return;
+
+    LazyBookParserProxy warm(makeBook(64 * 1024));
+    warm.getNumPages();
+    AllowListPolicy policy;
+    policy.allow(7);
+    AccessDecisionCache access(policy);
+    ProtectedBookParserProxy protectedProxy(warm, access, 7);
+    suite.run("proxy/protection_direct_call", [&](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+            doNotOptimize(warm.getNumPages());
+    });
+    suite.run("proxy/protection_cached_check", [&](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+            doNotOptimize(protectedProxy.getNumPages());
+    });
+}
+
+static void benchRemoteProxy(BenchmarkSuite &suite)
+{
+#ifndef _WIN32
+    const std::vector<size_t> inFlightCounts = { 1, 8, 64, 256 };
+    std::vector<std::string> names;
+    for (size_t inFlight : inFlightCounts)
+        names.push_back("proxy/remote_in_flight_" + std::to_string(inFlight));
+    if (!suite.anyEnabled(names))
+        return;
+
+    std::string remoteBook = tempPath("dp_bench_remote.txt");
+    {
+        std::ofstream out(remoteBook, std::ios::binary);
+        out << makeBook(64 * 1024);
+    }
+    std::string socketPath = tempPath("dp_bench.sock");
+    BookParserServer server(socketPath);
+    RemoteBookParserPool pool(socketPath, 4);
+    RemoteBookParserProxy remote(pool, remoteBook);
+    remote.getNumPages();
+    for (size_t i = 0; i < inFlightCounts.size(); ++i)
+    {
+        size_t inFlight = inFlightCounts[i];
+        std::vector<std::future<int>> pending(inFlight);
+        auto result = suite.run(names[i], [&](uint64_t n)
+        {
+            for (uint64_t i = 0; i < n; ++i)
+            {
+                for (auto &request : pending)
+                    request = remote.getNumPagesAsync();
+                for (auto &request : pending)
+                    doNotOptimize(request.get());
+            }
+        });
+        if (result)
+        {
+            double perBatch = result->seconds / double(result->iterations);
+            result->metric("requests_per_s", double(inFlight) / perBatch);
+            result->metric("batch_latency_us", perBatch * 1e6);
+        }
+    }
+    std::filesystem::remove(remoteBook);
+    std::filesystem::remove(BookIndex::pathFor(remoteBook));
+#else
+    (void)suite;
+#endif
+}
+
+// Each group builds its books and files only if one of its benchmarks is
+// going to run.
+static void benchProxy(BenchmarkSuite &suite)
+{
+    benchLazyProxies(suite);
+    checkConcurrentFirstAccess(suite);
+    benchCachedProxy(suite);
+    benchPageCounting(suite);
+    benchCorpus(suite);
+    benchProtectionProxy(suite);
+    benchRemoteProxy(suite);
+}
+
+static void benchBridge(BenchmarkSuite &suite)
+{
+    BookResource book;
+    SongResource song;
+    LongFormView longView(book);
+    ShortFormView shortView(song);
+    suite.run("bridge/view_show", [&](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            if (i & 1)
+                longView.show();
+            else
+                shortView.show();
+        }
+    });
+
+    std::string buffer;
+    suite.run("bridge/view_render_reused_buffer", [&](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            buffer.clear();
+            renderView(static_cast<VIEW_KIND>(i % 3),
+                (i & 1) ? static_cast<IResource&>(book) : song, buffer);
+        }
+    });
+
+    // Repeated renders of a small working set, with an edit every 1000.
+    RenderCache cache(64 * 1024);
+    std::vector<std::unique_ptr<BookResource>> resources;
+    for (int i = 0; i < 64; ++i)
+        resources.push_back(std::make_unique<BookResource>());
+    auto cached = suite.run("bridge/render_cache_repeated", [&](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            auto &resource = *resources[(i * 7) % resources.size()];
+            if (i % 1000 == 999)
+                resource.setTitle("Edited title " + std::to_string(i));
+            buffer.clear();
+            cache.render(static_cast<VIEW_KIND>(i % 3), resource, buffer);
+        }
+    });
+    if (cached)
+        cached->metric("hit_rate", cache.stats().hitRate());
+
+    const size_t numJobs = suite.large() ? 4000000 : 400000;
+    std::vector<BatchRenderer::Job> jobs;
+    for (size_t i = 0; i < numJobs; ++i)
+    {
+        jobs.push_back({ static_cast<VIEW_KIND>(i % 3), (i & 1) ?
+            static_cast<IResource*>(&book) : &song });
+    }
+    unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned numThreads = 1; numThreads <= maxThreads; numThreads *= 2)
+    {
+        std::string name = "bridge/batch_render_" + std::to_string(numJobs) +
+            "_views_" + std::to_string(numThreads) + "_threads";
+        if (!suite.enabled(name))
+            continue;
+        BatchRenderer renderer(numThreads);
+        std::FILE *devNull = std::fopen(
+#ifdef _WIN32
+            "NUL",
+#else
+            "/dev/null",
+#endif
+            "wb");
+        size_t bytes = 0;
+        auto result = suite.run(name, [&](uint64_t n)
+        {
+            for (uint64_t i = 0; i < n; ++i)
+                renderer.renderTo(devNull, jobs);
+        });
+        for (auto &rendered : renderer.render(jobs))
+            bytes += rendered.size();
+        std::fclose(devNull);
+        if (result)
+        {
+            double perBatch = result->seconds / double(result->iterations);
+            result->metric("views_per_s", double(numJobs) / perBatch);
+            result->metric("output_MB", double(bytes) / (1 << 20));
+        }
+    }
+}
+
+// A synthetic startup graph: layers of singletons whose constructors each
+// take about a millisecond, every one depending on two of the layer below.
+template <int N>
+struct SyntheticSingleton
+{
+    SyntheticSingleton()
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+};
+
+template <int Base, int... I>
+void addSyntheticSingletons(SingletonRegistry &registry,
+    std::integer_sequence<int, I...>)
+{
+    const int width = 8;
+    auto add = [&](int index, auto tag)
+    {
+        using T = SyntheticSingleton<decltype(tag)::value>;
+        std::vector<std::string> dependencies;
+        if (index >= width)
+        {
+            int below = index - width;
+            dependencies.push_back(std::to_string(Base + below));
+            dependencies.push_back(std::to_string(Base + (below + 1) % width +
+                (below / width) * width));
+        }
+        registry.add<T>(std::to_string(Base + index), dependencies);
+    };
+    (add(I, std::integral_constant<int, Base + I>()), ...);
+}
+
+static void benchSingleton(BenchmarkSuite &suite)
+{
+    auto serial = suite.once("singleton/startup_32_serial", []()
+    {
+        SingletonRegistry registry;
+        addSyntheticSingletons<0>(registry,
+            std::make_integer_sequence<int, 32>());
+        registry.initializeAll(1);
+    });
+    auto parallel = suite.once("singleton/startup_32_parallel", []()
+    {
+        SingletonRegistry registry;
+        addSyntheticSingletons<100>(registry,
+            std::make_integer_sequence<int, 32>());
+        registry.initializeAll(8);
+    });
+    if (serial && parallel)
+        parallel->metric("speedup", serial->seconds / parallel->seconds);
+
+    SingletonRegistry registry;
+    registry.add<SyntheticSingleton<1000>>("access", {});
+    registry.initializeAll(1);
+    suite.run("singleton/registered_access", [&](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+            doNotOptimize(RegisteredSingleton<SyntheticSingleton<1000>>::get());
+    });
+}
+
+static void benchLog(BenchmarkSuite &suite)
+{
+    NullLogSink nullSink;
+    setLogSink(nullSink);
+    suite.run("log/null_sink_line", [&](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+            logLine("Phone got new temperature of ", static_cast<int>(i));
+    });
+
+    std::FILE *devNull = std::fopen(
+#ifdef _WIN32
+        "NUL",
+#else
+        "/dev/null",
+#endif
+        "wb");
+    {
+        AsyncLogSink asyncSink(devNull);
+        setLogSink(asyncSink);
+        suite.run("log/async_sink_line", [&](uint64_t n)
+        {
+            for (uint64_t i = 0; i < n; ++i)
+                logLine("Phone got new temperature of ", static_cast<int>(i));
+            asyncSink.flush();
+        });
+        setLogSink(nullSink);
+    }
+    std::fclose(devNull);
+}
+
+// The cost of a trace point itself. Comparing the other benchmarks between
+// DesignPatternsBench and DesignPatternsBenchTraced gives the overhead on the
+// patterns' hot paths.
+static void benchTrace(BenchmarkSuite &suite)
+{
+#ifdef DESIGNPATTERNS_TRACING
+    for (bool enabled : { true, false })
+    {
+        Tracer::setEnabled(enabled);
+        suite.run(enabled ? "trace/scope_enabled" :
+            "trace/scope_runtime_disabled", [&](uint64_t n)
+        {
+            for (uint64_t i = 0; i < n; ++i)
+            {
+                TRACE_SCOPE("bench", "trace/scope");
+                doNotOptimize(i);
+            }
+        });
+    }
+    Tracer::setEnabled(true);
+#else
+    suite.run("trace/scope_compiled_out", [&](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            TRACE_SCOPE("bench", "trace/scope");
+            doNotOptimize(i);
+        }
+    });
+#endif
+}
+
+static void reportTraceStats()
+{
+#ifdef DESIGNPATTERNS_TRACING
+    std::printf("\n%-56s %12s %10s %10s %10s %10s\n", "trace point", "count",
+        "mean ns", "p50 ns", "p99 ns", "p999 ns");
+    for (auto &stats : Tracer::stats())
+    {
+        if (stats.count == 0)
+            continue;
+        std::string name = stats.category + "/" + stats.name;
+        std::printf("%-56s %12llu %10.1f %10llu %10llu %10llu\n",
+            name.c_str(), static_cast<unsigned long long>(stats.count),
+            stats.meanNs(),
+            static_cast<unsigned long long>(stats.percentileNs(50.0)),
+            static_cast<unsigned long long>(stats.percentileNs(99.0)),
+            static_cast<unsigned long long>(stats.percentileNs(99.9)));
+    }
+#endif
+}
+
+static void printUsage()
+{
+    std::printf(
+        "Usage: DesignPatternsBench [options]\n"
+        "  --filter <text>      only run benchmarks whose name contains text\n"
+        "  --json <path>        also write the results as JSON\n"
+        "  --min-time <seconds> minimum time per benchmark (default 0.2)\n"
+        "  --large              use production sized inputs (1 GB books,\n"
+        "                       1M element layouts, 10k book corpus)\n"
+        "  --trace <path>       write the last traced events as a Chrome\n"
+        "                       trace (DesignPatternsBenchTraced only)\n");
+}
+
+int main(int argc, char **argv)
+{
+    BenchmarkOptions options;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc)
+            options.filter = argv[++i];
+        else if (arg == "--json" && i + 1 < argc)
+            options.jsonPath = argv[++i];
+        else if (arg == "--min-time" && i + 1 < argc)
+            options.minSeconds = std::atof(argv[++i]);
+        else if (arg == "--trace" && i + 1 < argc)
+            options.tracePath = argv[++i];
+        else if (arg == "--large")
+            options.large = true;
+        else
+        {
+            printUsage();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    NullStreamBuffer nullBuffer;
+    std::streambuf *console = std::cout.rdbuf(&nullBuffer);
+    NullLogSink nullSink;
+    setLogSink(nullSink);
+
+    BenchmarkSuite suite(options);
+    benchStrategy(suite);
+    benchObserver(suite);
+    benchFactories(suite);
+    benchCommand(suite);
+    benchProxy(suite);
+    benchBridge(suite);
+    benchSingleton(suite);
+    benchLog(suite);
+    benchTrace(suite);
+
+    std::cout.rdbuf(console);
+    suite.report();
+    reportTraceStats();
+#ifdef DESIGNPATTERNS_TRACING
+    if (!options.tracePath.empty() &&
+        !Tracer::writeChromeTrace(options.tracePath))
+    {
+        std::fprintf(stderr, "Could not write %s\n",
+            options.tracePath.c_str());
+        return 1;
+    }
+#else
+    if (!options.tracePath.empty())
+    {
+        std::fprintf(stderr, "Tracing is compiled out, build "
+            "DesignPatternsBenchTraced to write a trace.\n");
+        return 1;
+    }
+#endif
+    if (!suite.writeJson())
+    {
+        std::fprintf(stderr, "Could not write %s\n",
+            options.jsonPath.c_str());
+        return 1;
+    }
+    return suite.failed() ? 1 : 0;
+}
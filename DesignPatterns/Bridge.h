@@ -10,75 +10,156 @@
 // abstract class. The more total resources we have, the benefits of the bridge
 // pattern shows.
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
 #include <iostream>
+#include <list>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
+#ifndef _WIN32
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+// Accessors return views rather than new strings, so rendering a resource
+// never allocates. The viewed text must stay valid as long as the resource.
 class IResource
 {
 public:
-    virtual std::string shortDescription() = 0;
-    virtual std::string longDescription() = 0;
-    virtual std::string title() = 0;
-    virtual std::string image() = 0;
-protected:
-    ~IResource() {};
-};
+    virtual std::string_view shortDescription() = 0;
+    virtual std::string_view longDescription() = 0;
+    virtual std::string_view title() = 0;
+    virtual std::string_view image() = 0;
 
-class SongResource : public IResource
-{
-public:
-    std::string shortDescription() override
+    // Unique for the lifetime of the process, unlike the resource's address.
+    uint64_t id() const { return m_id; }
+
+    // Changes every time the contents of the resource change.
+    uint64_t version() const
     {
-        return "Short song description.";
+        return m_version.load(std::memory_order_acquire);
     }
 
-    std::string longDescription() override
+protected:
+    IResource() : m_id(nextId()) {}
+    IResource(const IResource &other)
+        : m_id(nextId()), m_version(other.version()) {}
+    IResource& operator=(const IResource&)
     {
-        return "Long song description.";
+        markChanged();
+        return *this;
     }
+    ~IResource() {};
 
-    std::string title() override
+    void markChanged()
     {
-        return "Song title.";
+        m_version.fetch_add(1, std::memory_order_acq_rel);
     }
 
-    std::string image() override
+private:
+    static uint64_t nextId()
     {
-        return "Song's album image.";
+        static std::atomic<uint64_t> id{ 0 };
+        return ++id;
     }
+
+    uint64_t m_id;
+    std::atomic<uint64_t> m_version{ 0 };
 };
 
-class BookResource : public IResource
+// A resource whose text can be edited. Edits must not race with rendering.
+class TextResource : public IResource
 {
 public:
-    std::string shortDescription() override
+    TextResource(std::string shortDescription, std::string longDescription,
+        std::string title, std::string image)
+        : m_shortDescription(std::move(shortDescription)),
+        m_longDescription(std::move(longDescription)),
+        m_title(std::move(title)), m_image(std::move(image)) {}
+
+    std::string_view shortDescription() override { return m_shortDescription; }
+    std::string_view longDescription() override { return m_longDescription; }
+    std::string_view title() override { return m_title; }
+    std::string_view image() override { return m_image; }
+
+    void setShortDescription(std::string text)
     {
-        return "Short book description.";
+        m_shortDescription = std::move(text);
+        markChanged();
     }
 
-    std::string longDescription() override
+    void setLongDescription(std::string text)
     {
-        return "Long book description.";
+        m_longDescription = std::move(text);
+        markChanged();
     }
 
-    std::string title() override
+    void setTitle(std::string text)
     {
-        return "Book title.";
+        m_title = std::move(text);
+        markChanged();
     }
 
-    std::string image() override
+    void setImage(std::string text)
     {
-        return "Book's cover image.";
+        m_image = std::move(text);
+        markChanged();
     }
+
+private:
+    std::string m_shortDescription;
+    std::string m_longDescription;
+    std::string m_title;
+    std::string m_image;
+};
+
+class SongResource : public TextResource
+{
+public:
+    SongResource() : TextResource("Short song description.",
+        "Long song description.", "Song title.", "Song's album image.") {}
+};
+
+class BookResource : public TextResource
+{
+public:
+    BookResource() : TextResource("Short book description.",
+        "Long book description.", "Book title.", "Book's cover image.") {}
 };
 
 class View
 {
 public:
     View(IResource &resource) : m_resource(&resource) {}
-    virtual void show() = 0;
+
+    // Appends the view to out. Callers rendering many views can reuse one
+    // buffer, which stops allocating once it has grown large enough.
+    virtual void render(std::string &out) = 0;
+
+    void show()
+    {
+        thread_local std::string buffer;
+        buffer.clear();
+        render(buffer);
+        std::cout.write(buffer.data(), buffer.size());
+    }
 
 protected:
+    static void appendLine(std::string &out, std::string_view line)
+    {
+        out += line;
+        out += '\n';
+    }
+
     IResource *m_resource;
 };
 
@@ -86,12 +167,17 @@ class LongFormView : public View
 {
 public:
     LongFormView(IResource &resource) : View(resource) {};
-    void show() override
+    void render(std::string &out) override
+    {
+        renderResource(*m_resource, out);
+    }
+
+    static void renderResource(IResource &resource, std::string &out)
     {
-        std::cout << "Showing: " << std::endl;
-        std::cout << m_resource->image() << std::endl;
-        std::cout << m_resource->title() << std::endl;
-        std::cout << m_resource->longDescription() << std::endl;
+        appendLine(out, "Showing: ");
+        appendLine(out, resource.image());
+        appendLine(out, resource.title());
+        appendLine(out, resource.longDescription());
     }
 };
 
@@ -99,12 +185,17 @@ class MediumFormView : public View
 {
 public:
     MediumFormView(IResource &resource) : View(resource) {};
-    void show() override
+    void render(std::string &out) override
+    {
+        renderResource(*m_resource, out);
+    }
+
+    static void renderResource(IResource &resource, std::string &out)
     {
-        std::cout << "Showing: " << std::endl;
-        std::cout << m_resource->image() << std::endl;
-        std::cout << m_resource->title() << std::endl;
-        std::cout << m_resource->shortDescription() << std::endl;
+        appendLine(out, "Showing: ");
+        appendLine(out, resource.image());
+        appendLine(out, resource.title());
+        appendLine(out, resource.shortDescription());
     }
 };
 
@@ -112,14 +203,291 @@ class ShortFormView : public View
 {
 public:
     ShortFormView(IResource &resource) : View(resource) {};
-    void show() override
+    void render(std::string &out) override
+    {
+        renderResource(*m_resource, out);
+    }
+
+    static void renderResource(IResource &resource, std::string &out)
     {
-        std::cout << "Showing: " << std::endl;
-        std::cout << m_resource->title() << std::endl;
-        std::cout << m_resource->shortDescription() << std::endl;
+        appendLine(out, "Showing: ");
+        appendLine(out, resource.title());
+        appendLine(out, resource.shortDescription());
     }
 };
 
+enum class VIEW_KIND
+{
+    SHORT_FORM = 0,
+    MEDIUM_FORM = 1,
+    LONG_FORM = 2
+};
+
+// Renders a view of a resource without needing a View object for it.
+inline void renderView(VIEW_KIND kind, IResource &resource, std::string &out)
+{
+    switch (kind)
+    {
+    case VIEW_KIND::SHORT_FORM:
+        ShortFormView::renderResource(resource, out);
+        break;
+    case VIEW_KIND::MEDIUM_FORM:
+        MediumFormView::renderResource(resource, out);
+        break;
+    case VIEW_KIND::LONG_FORM:
+        LongFormView::renderResource(resource, out);
+        break;
+    }
+}
+
+// Remembers rendered views, keyed by view kind, resource id and resource
+// version. Editing a resource changes its version, so stale renders are never
+// returned and get replaced on their next use. The cache is bounded by the
+// bytes of rendered text it holds, and evicts least recently used renders.
+class RenderCache
+{
+public:
+    struct Stats
+    {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t invalidations; // Misses caused by a resource edit.
+        uint64_t evictions;
+        size_t bytes;
+
+        double hitRate() const
+        {
+            uint64_t total = hits + misses;
+            return total == 0 ? 0.0 : double(hits) / double(total);
+        }
+    };
+
+    RenderCache(size_t budgetBytes) : m_budget(budgetBytes) {}
+
+    // Appends the view of the resource to out.
+    void render(VIEW_KIND kind, IResource &resource, std::string &out)
+    {
+        uint64_t key = resource.id() * 3 + static_cast<uint64_t>(kind);
+        uint64_t version = resource.version();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto found = m_index.find(key);
+        if (found != m_index.end())
+        {
+            Entry &entry = *found->second;
+            if (entry.version == version)
+            {
+                ++m_stats.hits;
+                m_lru.splice(m_lru.begin(), m_lru, found->second);
+                out += entry.text;
+                return;
+            }
+            ++m_stats.invalidations;
+            m_stats.bytes -= entry.text.size();
+            m_lru.erase(found->second);
+            m_index.erase(found);
+        }
+
+        ++m_stats.misses;
+        std::string text;
+        renderView(kind, resource, text);
+        out += text;
+        if (text.size() > m_budget)
+            return;
+
+        m_stats.bytes += text.size();
+        m_lru.push_front({ key, version, std::move(text) });
+        m_index[key] = m_lru.begin();
+        while (m_stats.bytes > m_budget)
+        {
+            Entry &victim = m_lru.back();
+            m_stats.bytes -= victim.text.size();
+            m_index.erase(victim.key);
+            m_lru.pop_back();
+            ++m_stats.evictions;
+        }
+    }
+
+    Stats stats()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stats;
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t key;
+        uint64_t version;
+        std::string text;
+    };
+
+    size_t m_budget;
+    std::mutex m_mutex;
+    std::list<Entry> m_lru; // Most recently used first.
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> m_index;
+    Stats m_stats{};
+};
+
+// Renders large batches of (view kind, resource) pairs for export. The batch
+// is split into one contiguous slice per thread, each slice is rendered into
+// that thread's own buffer, and the buffers are written out in order with a
+// single vectored write. The threads are kept around between batches.
+// Only one batch can be rendered at a time.
+class BatchRenderer
+{
+public:
+    struct Job
+    {
+        VIEW_KIND kind;
+        IResource *resource;
+    };
+
+    // numThreads of 0 uses every hardware thread. The calling thread counts
+    // as one of them.
+    BatchRenderer(unsigned numThreads = 0)
+    {
+        if (numThreads == 0)
+            numThreads = std::max(1u, std::thread::hardware_concurrency());
+        m_buffers.resize(numThreads);
+        for (unsigned i = 1; i < numThreads; ++i)
+            m_workers.emplace_back([this, i]() { workerLoop(i); });
+    }
+
+    BatchRenderer(const BatchRenderer&) = delete;
+    BatchRenderer& operator=(const BatchRenderer&) = delete;
+
+    ~BatchRenderer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_all();
+        for (auto &worker : m_workers)
+            worker.join();
+    }
+
+    // Returns the rendered batch as consecutive buffers. They are reused by
+    // the next call.
+    const std::vector<std::string>& render(const std::vector<Job> &jobs)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs = &jobs;
+            m_remaining = m_workers.size();
+            ++m_generation;
+        }
+        m_wake.notify_all();
+        renderSlice(0);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [this]() { return m_remaining == 0; });
+        m_jobs = nullptr;
+        return m_buffers;
+    }
+
+    // Returns false if writing failed.
+    bool renderTo(std::FILE *out, const std::vector<Job> &jobs)
+    {
+        render(jobs);
+        std::fflush(out);
+#ifndef _WIN32
+        return writeBuffers(fileno(out));
+#else
+        for (auto &buffer : m_buffers)
+        {
+            if (std::fwrite(buffer.data(), 1, buffer.size(), out) !=
+                buffer.size())
+                return false;
+        }
+        return std::fflush(out) == 0;
+#endif
+    }
+
+private:
+    void workerLoop(unsigned index)
+    {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;)
+        {
+            m_wake.wait(lock, [&]() {
+                return m_stopping || m_generation != seen; });
+            if (m_stopping)
+                return;
+            seen = m_generation;
+
+            lock.unlock();
+            renderSlice(index);
+            lock.lock();
+            if (--m_remaining == 0)
+                m_done.notify_one();
+        }
+    }
+
+    void renderSlice(unsigned index)
+    {
+        const std::vector<Job> &jobs = *m_jobs;
+        size_t numSlices = m_buffers.size();
+        size_t begin = jobs.size() * index / numSlices;
+        size_t end = jobs.size() * (index + 1) / numSlices;
+
+        std::string &buffer = m_buffers[index];
+        buffer.clear();
+        for (size_t i = begin; i < end; ++i)
+            renderView(jobs[i].kind, *jobs[i].resource, buffer);
+    }
+
+#ifndef _WIN32
+    bool writeBuffers(int fd)
+    {
+        std::vector<iovec> pending;
+        for (auto &buffer : m_buffers)
+        {
+            if (!buffer.empty())
+                pending.push_back({ &buffer[0], buffer.size() });
+        }
+
+        const size_t maxVectors = 1024;
+        size_t first = 0;
+        while (first < pending.size())
+        {
+            int count = static_cast<int>(std::min(maxVectors,
+                pending.size() - first));
+            ssize_t written = writev(fd, &pending[first], count);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written < 0)
+                return false;
+
+            // Skip whatever was fully written, and trim a partial write.
+            size_t left = static_cast<size_t>(written);
+            while (first < pending.size() && left >= pending[first].iov_len)
+                left -= pending[first++].iov_len;
+            if (left > 0)
+            {
+                pending[first].iov_base =
+                    static_cast<char*>(pending[first].iov_base) + left;
+                pending[first].iov_len -= left;
+            }
+        }
+        return true;
+    }
+#endif
+
+    std::vector<std::string> m_buffers;
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    const std::vector<Job> *m_jobs{ nullptr };
+    size_t m_remaining{ 0 };
+    uint64_t m_generation{ 0 };
+    bool m_stopping{ false };
+};
+
 void BridgeDemo()
 {
     BookResource br;
@@ -10,6 +10,9 @@
 #include <memory>
 #include <stack>
 
+#include "Log.h"
+#include "Trace.h"
+
 class ICommand
 {
 public:
@@ -23,32 +26,32 @@ class Car
 public:
     void turnEngineOn()
     {
-        std::cout << "Car engine turned on." << std::endl;
+        logLine("Car engine turned on.");
     }
 
     void turnEngineOff()
     {
-        std::cout << "Car turned off." << std::endl;
+        logLine("Car turned off.");
     }
 
     void moveLeft()
     {
-        std::cout << "Car moved left." << std::endl;
+        logLine("Car moved left.");
     }
 
     void moveRight()
     {
-        std::cout << "Car moved right." << std::endl;
+        logLine("Car moved right.");
     }
 
     void lockDoors()
     {
-        std::cout << "Car doors locked." << std::endl;
+        logLine("Car doors locked.");
     }
 
     void unlockDoors()
     {
-        std::cout << "Car doors unlocked." << std::endl;
+        logLine("Car doors unlocked.");
     }
 };
 
@@ -58,6 +61,7 @@ public:
     TurnCarOn(Car *car) : m_car(car) {}
     void execute() override
     {
+        TRACE_SCOPE("command", "TurnCarOn::execute");
         m_car->turnEngineOn();
     }
 
@@ -76,6 +80,7 @@ public:
     MoveCarLeft(Car *car) : m_car(car) {}
     void execute() override
     {
+        TRACE_SCOPE("command", "MoveCarLeft::execute");
         m_car->moveLeft();
     }
 
@@ -94,6 +99,7 @@ public:
     LockCarDoors(Car *car) : m_car(car) {}
     void execute() override
     {
+        TRACE_SCOPE("command", "LockCarDoors::execute");
         m_car->lockDoors();
     }
 
@@ -152,7 +158,7 @@ public:
         }
         else
         {
-            std::cout << "No commands left to unexecute." << std::endl;
+            logLine("No commands left to unexecute.");
         }
     }
 
@@ -220,6 +226,7 @@ inline void CommandDemo()
             default:
                 break;
             }
+            logSink().flush();
         }
         else
         {
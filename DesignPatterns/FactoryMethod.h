@@ -11,16 +11,14 @@
 #include <iostream>
 #include <memory>
 
+#include "Log.h"
+#include "Trace.h"
+
 struct vec2
 {
     int x, y;
 };
 
-void printVec2(vec2 v)
-{
-    std::cout << "(" << v.x << ", " << v.y << ")";
-}
-
 class IObstacle
 {
 public:
@@ -38,12 +36,8 @@ public:
     Asteroid(vec2 speed, vec2 size) : IObstacle(speed, size) {}
     void printContents() override
     {
-        std::cout << "Asteroid with speed: ";
-        printVec2(m_speed);
-        std::cout << std::endl;
-        std::cout << "Asteroid with size: ";
-        printVec2(m_size);
-        std::cout << std::endl;
+        logLine("Asteroid with speed: (", m_speed.x, ", ", m_speed.y, ")");
+        logLine("Asteroid with size: (", m_size.x, ", ", m_size.y, ")");
     }
 };
 
@@ -53,12 +47,8 @@ public:
     SpaceDebris(vec2 speed, vec2 size) : IObstacle(speed, size) {}
     void printContents() override
     {
-        std::cout << "SpaceDebris with speed: ";
-        printVec2(m_speed);
-        std::cout << std::endl;
-        std::cout << "SpaceDebris with size: ";
-        printVec2(m_size);
-        std::cout << std::endl;
+        logLine("SpaceDebris with speed: (", m_speed.x, ", ", m_speed.y, ")");
+        logLine("SpaceDebris with size: (", m_size.x, ", ", m_size.y, ")");
     }
 };
 
@@ -67,6 +57,7 @@ class ObstacleFactory
 public:
     std::unique_ptr<IObstacle> createObstacle(int level)
     {
+        TRACE_SCOPE("factory_method", "ObstacleFactory::createObstacle");
         if (level == 0)
         {
             return std::make_unique<Asteroid>(vec2{ 1, 1 }, vec2{1, 1});
@@ -83,6 +74,7 @@ public:
         {
             return std::make_unique<SpaceDebris>(vec2{ 4, 4 }, vec2{ 10, 10 });
         }
+        return nullptr;
     }
 };
 
@@ -101,6 +93,7 @@ inline void FactoryDemo()
             std::unique_ptr<IObstacle> obj = of.createObstacle(temp);
             std::cout << "The following has been loaded." << std::endl;
             obj->printContents();
+            logSink().flush();
             std::cout << std::endl;
         }
         else if (temp != -1)
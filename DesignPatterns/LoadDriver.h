@@ -0,0 +1,574 @@
+#pragma once
+// Drives the demos' underlying operations headlessly, at full speed or at a
+// fixed rate, and reports throughput and latency percentiles. Used by
+//   DesignPatterns --workload "pattern=command mix=execute:3,undo:1 threads=4"
+//   DesignPatterns --script workloads.txt
+// A script holds one workload per line, blank lines and lines starting with
+// # are skipped.
+
+// A workload is a list of key=value settings, separated by spaces:
+//   pattern   strategy, observer, factory_method, abstract_factory, command,
+//             proxy or bridge
+//   mix       operations and their weights, e.g. execute:3,undo:1. Weights
+//             are whole numbers up to 10000. Defaults to every operation of
+//             the pattern with weight 1
+//   threads   threads driving the pattern, each with its own objects, up to
+//             1024 (1)
+//   rate      total operations per second up to 1e9, 0 runs flat out (0)
+//   duration  seconds to run for, up to 86400 (1)
+//   observers observers per weather station, for pattern=observer, up to
+//             100000 (16)
+// When a rate is set, latency is measured from the time an operation was
+// scheduled to start, so falling behind the rate shows up as latency.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Strategy.h"
+#include "Observer.h"
+#include "FactoryMethod.h"
+#include "AbstractFactory.h"
+#include "Command.h"
+#include "Proxy.h"
+#include "Bridge.h"
+#include "Log.h"
+#include "Trace.h"
+
+// Log linear buckets: exact below 16 ns, then 16 buckets per power of two,
+// so a reported percentile is at most 1/16 above the real one.
+class LatencyHistogram
+{
+public:
+    static constexpr size_t SUB_BUCKETS = 16;
+    static constexpr size_t NUM_BUCKETS = SUB_BUCKETS * 61;
+
+    void record(uint64_t ns)
+    {
+        ++m_buckets[bucketFor(ns)];
+        ++m_count;
+        m_max = std::max(m_max, ns);
+    }
+
+    void merge(const LatencyHistogram &other)
+    {
+        for (size_t i = 0; i < NUM_BUCKETS; ++i)
+            m_buckets[i] += other.m_buckets[i];
+        m_count += other.m_count;
+        m_max = std::max(m_max, other.m_max);
+    }
+
+    uint64_t count() const { return m_count; }
+    uint64_t max() const { return m_max; }
+
+    // Upper bound of the bucket holding the given percentile, e.g. 99.9.
+    uint64_t percentile(double percentile) const
+    {
+        uint64_t target = uint64_t(double(m_count) * percentile / 100.0);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < NUM_BUCKETS; ++i)
+        {
+            seen += m_buckets[i];
+            if (seen > target)
+                return std::min(upperBound(i), m_max);
+        }
+        return m_max;
+    }
+
+private:
+    static size_t bucketFor(uint64_t ns)
+    {
+        if (ns < SUB_BUCKETS)
+            return size_t(ns);
+        int exponent = 63;
+        while ((ns >> exponent) == 0)
+            --exponent;
+        size_t sub = size_t(ns >> (exponent - 4)) & (SUB_BUCKETS - 1);
+        return SUB_BUCKETS * size_t(exponent - 3) + sub;
+    }
+
+    static uint64_t upperBound(size_t bucket)
+    {
+        if (bucket < SUB_BUCKETS)
+            return bucket;
+        int exponent = int(bucket / SUB_BUCKETS) + 3;
+        uint64_t sub = bucket % SUB_BUCKETS;
+        uint64_t width = uint64_t(1) << (exponent - 4);
+        return ((SUB_BUCKETS + sub) << (exponent - 4)) + width - 1;
+    }
+
+    std::vector<uint64_t> m_buckets = std::vector<uint64_t>(NUM_BUCKETS);
+    uint64_t m_count{ 0 };
+    uint64_t m_max{ 0 };
+};
+
+struct LoadSpec
+{
+    static constexpr unsigned MAX_THREADS = 1024;
+    static constexpr unsigned MAX_OBSERVERS = 100000;
+    static constexpr unsigned MAX_WEIGHT = 10000;
+    static constexpr unsigned MAX_RATE = 1000000000;
+    static constexpr unsigned MAX_DURATION = 86400;
+
+    std::string pattern;
+    std::vector<std::pair<std::string, unsigned>> mix;
+    unsigned threads{ 1 };
+    double rate{ 0.0 };
+    double duration{ 1.0 };
+    unsigned observers{ 16 };
+
+    // Throws std::invalid_argument if the spec does not parse.
+    static LoadSpec parse(const std::string &text)
+    {
+        LoadSpec spec;
+        std::istringstream settings(text);
+        std::string setting;
+        while (settings >> setting)
+        {
+            size_t equals = setting.find('=');
+            if (equals == std::string::npos)
+                throw std::invalid_argument("Expected key=value: " + setting);
+            std::string key = setting.substr(0, equals);
+            std::string value = setting.substr(equals + 1);
+            if (key == "pattern")
+                spec.pattern = value;
+            else if (key == "mix")
+                spec.mix = parseMix(value);
+            else if (key == "threads")
+                spec.threads = parseCount(key, value, MAX_THREADS);
+            else if (key == "rate")
+                spec.rate = parseNumber(key, value, 0, MAX_RATE);
+            else if (key == "duration")
+                spec.duration = parseNumber(key, value, 0, MAX_DURATION);
+            else if (key == "observers")
+                spec.observers = parseCount(key, value, MAX_OBSERVERS);
+            else
+                throw std::invalid_argument("Unknown setting: " + key);
+        }
+        if (spec.pattern.empty())
+            throw std::invalid_argument("A workload needs a pattern.");
+        return spec;
+    }
+
+    std::string describe() const
+    {
+        std::ostringstream out;
+        out << "pattern=" << pattern << " mix=";
+        if (mix.empty())
+            out << "all";
+        for (size_t i = 0; i < mix.size(); ++i)
+        {
+            out << (i == 0 ? "" : ",") << mix[i].first << ':'
+                << mix[i].second;
+        }
+        out << " threads=" << threads << " rate=" << rate
+            << " duration=" << duration;
+        if (pattern == "observer")
+            out << " observers=" << observers;
+        return out.str();
+    }
+
+private:
+    // A number from minimum to maximum. Rejects nan and infinities.
+    static double parseNumber(const std::string &key,
+        const std::string &value, unsigned minimum, unsigned maximum)
+    {
+        size_t parsed = 0;
+        double number = 0.0;
+        try
+        {
+            number = std::stod(value, &parsed);
+        }
+        catch (const std::exception&)
+        {
+        }
+        if (parsed != value.size() ||
+            !(number >= minimum && number <= maximum))
+        {
+            throw std::invalid_argument("Bad value for " + key + ": " + value +
+                ", expected a number from " + std::to_string(minimum) +
+                " to " + std::to_string(maximum));
+        }
+        return number;
+    }
+
+    // A whole number from 1 to maximum.
+    static unsigned parseCount(const std::string &key,
+        const std::string &value, unsigned maximum)
+    {
+        double number = parseNumber(key, value, 1, maximum);
+        if (number != std::floor(number))
+        {
+            throw std::invalid_argument("Bad value for " + key + ": " + value +
+                ", expected a whole number from 1 to " +
+                std::to_string(maximum));
+        }
+        return unsigned(number);
+    }
+
+    static std::vector<std::pair<std::string, unsigned>> parseMix(
+        const std::string &text)
+    {
+        std::vector<std::pair<std::string, unsigned>> mix;
+        std::istringstream entries(text);
+        std::string entry;
+        while (std::getline(entries, entry, ','))
+        {
+            size_t colon = entry.find(':');
+            std::string name = entry.substr(0, colon);
+            unsigned weight = colon == std::string::npos ? 1 :
+                parseCount("mix", entry.substr(colon + 1), MAX_WEIGHT);
+            mix.emplace_back(name, weight);
+        }
+        return mix;
+    }
+};
+
+// The operations of one pattern, bound to objects owned by a single thread.
+using LoadOperations =
+    std::vector<std::pair<std::string, std::function<void()>>>;
+
+namespace load_detail
+{
+    inline std::string sampleBook()
+    {
+        std::string book;
+        for (int line = 0; line < 5000; ++line)
+            book += "It was a dark and stormy night; the rain fell.\n";
+        return book;
+    }
+
+    // Builds one thread's objects for the pattern, mirroring its demo.
+    inline LoadOperations buildOperations(const LoadSpec &spec)
+    {
+        LoadOperations ops;
+        if (spec.pattern == "strategy")
+        {
+            struct State
+            {
+                SimpleQuack sq;
+                SimpleFly sf;
+                NoQuack nq;
+                NoFly nf;
+                Duck typicalDuck{ sq, sf };
+                Duck rubberDuck{ nq, nf };
+            };
+            auto state = std::make_shared<State>();
+            ops.emplace_back("quack", [state]() {
+                state->typicalDuck.quack();
+                state->rubberDuck.quack(); });
+            ops.emplace_back("fly", [state]() {
+                state->typicalDuck.fly();
+                state->rubberDuck.fly(); });
+        }
+        else if (spec.pattern == "observer")
+        {
+            struct State
+            {
+                WeatherStationObservable wso;
+                std::vector<std::unique_ptr<PhoneDisplayObserver>> observers;
+                int temperature{ 0 };
+            };
+            auto state = std::make_shared<State>();
+            for (unsigned i = 0; i < spec.observers; ++i)
+            {
+                state->observers.push_back(
+                    std::make_unique<PhoneDisplayObserver>(state->wso));
+                state->wso.add(*state->observers.back());
+            }
+            ops.emplace_back("notify", [state]() {
+                state->temperature ^= 1;
+                state->wso.setTemperature(state->temperature); });
+        }
+        else if (spec.pattern == "factory_method")
+        {
+            auto factory = std::make_shared<ObstacleFactory>();
+            auto level = std::make_shared<int>(0);
+            ops.emplace_back("create", [factory, level]() {
+                *level = (*level + 1) & 3;
+                factory->createObstacle(*level)->printContents(); });
+        }
+        else if (spec.pattern == "abstract_factory")
+        {
+            auto factory =
+                std::make_shared<UserInterfaceFactory>(OS_TYPE::WINDOWS);
+            auto mac = std::make_shared<bool>(false);
+            ops.emplace_back("dialog", [factory, mac]() {
+                *mac = !*mac;
+                factory->setOSType(*mac ? OS_TYPE::MAC : OS_TYPE::WINDOWS);
+                factory->createDialogbox(2)->printContents(); });
+            ops.emplace_back("menu", [factory, mac]() {
+                *mac = !*mac;
+                factory->setOSType(*mac ? OS_TYPE::MAC : OS_TYPE::WINDOWS);
+                factory->createMenu(3)->printContents(); });
+        }
+        else if (spec.pattern == "command")
+        {
+            struct State
+            {
+                Car car;
+                RemoteControlA rc;
+                unsigned next{ 0 };
+            };
+            auto state = std::make_shared<State>();
+            state->rc.setButtonA(std::make_unique<TurnCarOn>(&state->car));
+            state->rc.setButtonB(std::make_unique<MoveCarLeft>(&state->car));
+            state->rc.setButtonC(std::make_unique<LockCarDoors>(&state->car));
+            ops.emplace_back("execute", [state]() {
+                switch (state->next++ % 3)
+                {
+                case 0: state->rc.pressButtonA(); break;
+                case 1: state->rc.pressButtonB(); break;
+                default: state->rc.pressButtonC(); break;
+                } });
+            ops.emplace_back("undo", [state]() {
+                state->rc.undoLastCommand(); });
+        }
+        else if (spec.pattern == "proxy")
+        {
+            auto book = BookSource::fromString(sampleBook());
+            auto warm = std::make_shared<LazyBookParserProxy>(book);
+            ops.emplace_back("first_access", [book]() {
+                LazyBookParserProxy proxy(book);
+                proxy.getNumPages(); });
+            ops.emplace_back("warm_access", [warm]() {
+                warm->getNumPages(); });
+            ops.emplace_back("cached_access", [book]() {
+                CachedBookParserProxy proxy(book);
+                proxy.getNumPages(); });
+        }
+        else if (spec.pattern == "bridge")
+        {
+            struct State
+            {
+                BookResource book;
+                SongResource song;
+                ShortFormView shortView{ book };
+                MediumFormView mediumView{ song };
+                LongFormView longView{ book };
+                unsigned next{ 0 };
+            };
+            auto state = std::make_shared<State>();
+            ops.emplace_back("show", [state]() {
+                switch (state->next++ % 3)
+                {
+                case 0: state->shortView.show(); break;
+                case 1: state->mediumView.show(); break;
+                default: state->longView.show(); break;
+                } });
+        }
+        else
+        {
+            throw std::invalid_argument("Unknown pattern: " + spec.pattern);
+        }
+        return ops;
+    }
+}
+
+struct LoadResult
+{
+    double seconds{ 0.0 };
+    std::vector<std::string> operations;
+    std::vector<LatencyHistogram> latencies; // One per operation.
+    LatencyHistogram total;
+};
+
+// Runs one workload. Output from the patterns is discarded while it runs.
+inline LoadResult runLoad(const LoadSpec &spec)
+{
+    // Built up front, so a bad pattern or mix throws before any thread starts.
+    std::vector<LoadOperations> threadOps;
+    for (unsigned t = 0; t < spec.threads; ++t)
+        threadOps.push_back(load_detail::buildOperations(spec));
+
+    // The mix expanded into a repeating sequence of operation indexes. The
+    // weights are divided by their greatest common divisor first, so only
+    // their ratios decide its length.
+    LoadResult result;
+    for (auto &op : threadOps[0])
+        result.operations.push_back(op.first);
+    std::vector<size_t> sequence;
+    auto mix = spec.mix;
+    if (mix.empty())
+    {
+        for (auto &name : result.operations)
+            mix.emplace_back(name, 1);
+    }
+    unsigned divisor = 0;
+    for (auto &entry : mix)
+        divisor = std::gcd(divisor, entry.second);
+    for (auto &entry : mix)
+    {
+        auto found = std::find(result.operations.begin(),
+            result.operations.end(), entry.first);
+        if (found == result.operations.end())
+        {
+            throw std::invalid_argument("Pattern " + spec.pattern +
+                " has no operation " + entry.first + ".");
+        }
+        sequence.insert(sequence.end(), entry.second / divisor,
+            size_t(found - result.operations.begin()));
+    }
+
+    NullLogSink nullSink;
+    ILogSink &previousSink = logSink();
+    setLogSink(nullSink);
+    NullStreamBuffer nullBuffer;
+    std::streambuf *console = std::cout.rdbuf(&nullBuffer);
+
+    // Every thread gets an equal share of the rate.
+    const uint64_t durationTicks =
+        TraceClock::fromDurationNs(uint64_t(spec.duration * 1e9));
+    const double intervalTicks = spec.rate > 0.0 ? double(spec.threads) /
+        spec.rate * double(TraceClock::fromDurationNs(1000000000)) : 0.0;
+    std::vector<std::vector<LatencyHistogram>> latencies(spec.threads,
+        std::vector<LatencyHistogram>(result.operations.size()));
+
+    auto runThread = [&](unsigned t)
+    {
+        LoadOperations &ops = threadOps[t];
+        std::vector<LatencyHistogram> &histograms = latencies[t];
+        size_t position = t % sequence.size();
+        uint64_t start = TraceClock::ticks();
+        uint64_t end = start + durationTicks;
+        double scheduled = double(start);
+        for (;;)
+        {
+            uint64_t opStart = TraceClock::ticks();
+            if (opStart >= end)
+                break;
+            if (intervalTicks > 0.0)
+            {
+                // An operation due at or after the end is not run, but the
+                // thread still waits out the duration so the throughput is
+                // measured over all of it.
+                double waitUntil = std::min(scheduled, double(end));
+                while (double(opStart) < waitUntil)
+                {
+                    double waitNs = double(TraceClock::toDurationNs(
+                        uint64_t(waitUntil - double(opStart))));
+                    if (waitNs > 200000.0)
+                    {
+                        std::this_thread::sleep_for(std::chrono::nanoseconds(
+                            uint64_t(waitNs) - 100000));
+                    }
+                    else
+                    {
+                        std::this_thread::yield();
+                    }
+                    opStart = TraceClock::ticks();
+                }
+                if (scheduled >= double(end))
+                    break;
+                opStart = uint64_t(scheduled);
+                scheduled += intervalTicks;
+            }
+
+            size_t op = sequence[position];
+            position = position + 1 == sequence.size() ? 0 : position + 1;
+            ops[op].second();
+            histograms[op].record(TraceClock::toDurationNs(
+                TraceClock::ticks() - opStart));
+        }
+    };
+
+    auto startTime = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < spec.threads; ++t)
+        threads.emplace_back(runThread, t);
+    runThread(0);
+    for (auto &thread : threads)
+        thread.join();
+    result.seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - startTime).count();
+
+    std::cout.rdbuf(console);
+    setLogSink(previousSink);
+
+    result.latencies.resize(result.operations.size());
+    for (auto &threadLatencies : latencies)
+    {
+        for (size_t op = 0; op < threadLatencies.size(); ++op)
+        {
+            result.latencies[op].merge(threadLatencies[op]);
+            result.total.merge(threadLatencies[op]);
+        }
+    }
+    return result;
+}
+
+inline void printLoadResult(const LoadSpec &spec, const LoadResult &result)
+{
+    std::printf("workload: %s\n", spec.describe().c_str());
+    std::printf("  %llu ops in %.3f s, %.0f ops/s\n",
+        static_cast<unsigned long long>(result.total.count()), result.seconds,
+        double(result.total.count()) / result.seconds);
+    std::printf("  %-16s %12s %10s %10s %10s %12s\n", "operation", "count",
+        "p50 ns", "p99 ns", "p999 ns", "max ns");
+    auto printRow = [](const std::string &name, const LatencyHistogram &h)
+    {
+        std::printf("  %-16s %12llu %10llu %10llu %10llu %12llu\n",
+            name.c_str(), static_cast<unsigned long long>(h.count()),
+            static_cast<unsigned long long>(h.percentile(50.0)),
+            static_cast<unsigned long long>(h.percentile(99.0)),
+            static_cast<unsigned long long>(h.percentile(99.9)),
+            static_cast<unsigned long long>(h.max()));
+    };
+    for (size_t op = 0; op < result.operations.size(); ++op)
+    {
+        if (result.latencies[op].count() != 0)
+            printRow(result.operations[op], result.latencies[op]);
+    }
+    printRow("all", result.total);
+    std::printf("\n");
+}
+
+// Runs each workload in turn and prints its results. Returns the process
+// exit code.
+inline int runLoadDriver(const std::vector<std::string> &workloads)
+{
+    try
+    {
+        std::vector<LoadSpec> specs;
+        for (auto &workload : workloads)
+            specs.push_back(LoadSpec::parse(workload));
+        for (auto &spec : specs)
+            printLoadResult(spec, runLoad(spec));
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
+
+// Reads the workloads of a script, one per line.
+inline std::vector<std::string> readLoadScript(const std::string &path)
+{
+    std::ifstream in(path);
+    if (!in)
+        throw std::runtime_error("Could not open " + path);
+    std::vector<std::string> workloads;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first != std::string::npos && line[first] != '#')
+            workloads.push_back(line);
+    }
+    return workloads;
+}
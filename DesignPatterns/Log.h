@@ -0,0 +1,385 @@
+#pragma once
+// Where the patterns' receivers and observers write their output. Writing
+// straight to std::cout with std::endl flushes on every line, which dominates
+// the cost of the patterns themselves under load, so output goes through a
+// pluggable ILogSink instead.
+
+// The default sink is an AsyncLogSink: every thread appends lines to its own
+// lock free ring buffer, and a background thread drains all of them to
+// stdout in batches. Lines from one thread stay in order, lines from
+// different threads may interleave differently than they were written.
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+class ILogSink
+{
+public:
+    virtual ~ILogSink() {}
+
+    // Writes one line, the sink adds the line break.
+    virtual void write(std::string_view line) = 0;
+
+    // Returns once everything written before the call is out.
+    virtual void flush() {}
+};
+
+// Drops everything, for measuring the patterns without their output.
+class NullLogSink : public ILogSink
+{
+public:
+    void write(std::string_view) override {}
+};
+
+// The same for what the patterns still print straight to std::cout
+// (strategies, UI elements, views), installed with std::cout.rdbuf().
+class NullStreamBuffer : public std::streambuf
+{
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) override
+    {
+        return n;
+    }
+};
+
+// Writes synchronously, without flushing after every line.
+class ConsoleLogSink : public ILogSink
+{
+public:
+    ConsoleLogSink(std::FILE *out = stdout) : m_out(out) {}
+
+    void write(std::string_view line) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::fwrite(line.data(), 1, line.size(), m_out);
+        std::fputc('\n', m_out);
+    }
+
+    void flush() override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::fflush(m_out);
+    }
+
+private:
+    std::mutex m_mutex;
+    std::FILE *m_out;
+};
+
+class AsyncLogSink : public ILogSink
+{
+public:
+    // ringSize is the bytes buffered per writing thread, rounded up to a
+    // power of two.
+    AsyncLogSink(std::FILE *out = stdout, size_t ringSize = 64 * 1024)
+        : m_out(out), m_ringSize(roundUpToPowerOfTwo(ringSize)),
+        m_id(nextId())
+    {
+        m_flusher = std::thread([this]() { runFlusher(); });
+    }
+
+    AsyncLogSink(const AsyncLogSink&) = delete;
+    AsyncLogSink& operator=(const AsyncLogSink&) = delete;
+
+    ~AsyncLogSink()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_one();
+        m_flusher.join();
+    }
+
+    void write(std::string_view line) override
+    {
+        Ring &ring = ringForThisThread();
+        size_t needed = line.size() + 1;
+        if (needed > m_ringSize)
+        {
+            // Too big to ever fit. Let the ring drain first so this thread's
+            // lines stay in order, then write it directly.
+            waitForSpace(ring, m_ringSize);
+            std::lock_guard<std::mutex> lock(m_outMutex);
+            std::fwrite(line.data(), 1, line.size(), m_out);
+            std::fputc('\n', m_out);
+            return;
+        }
+
+        waitForSpace(ring, needed);
+        size_t head = ring.head.load(std::memory_order_relaxed);
+        copyIn(ring, head, line.data(), line.size());
+        copyIn(ring, head + line.size(), "\n", 1);
+
+        // Only a line landing in an empty ring can find the flusher asleep,
+        // and then only if it went to sleep before seeing the line.
+        ring.head.store(head + needed, std::memory_order_seq_cst);
+        if (ring.tail.load(std::memory_order_seq_cst) == head &&
+            m_flusherAsleep.load(std::memory_order_seq_cst))
+            wakeFlusher();
+    }
+
+    void flush() override
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        uint64_t request = ++m_flushRequests;
+        m_wake.notify_one();
+        m_flushed.wait(lock, [&]() { return m_flushesDone >= request; });
+    }
+
+private:
+    // Single producer (the owning thread), single consumer (the flusher).
+    // head and tail only ever grow, and index the buffer modulo its size.
+    struct Ring
+    {
+        Ring(size_t size) : data(new char[size]) {}
+
+        std::unique_ptr<char[]> data;
+        alignas(64) std::atomic<size_t> head{ 0 };
+        alignas(64) std::atomic<size_t> tail{ 0 };
+    };
+
+    static size_t roundUpToPowerOfTwo(size_t n)
+    {
+        size_t size = 64;
+        while (size < n)
+            size <<= 1;
+        return size;
+    }
+
+    static uint64_t nextId()
+    {
+        static std::atomic<uint64_t> id{ 0 };
+        return ++id;
+    }
+
+    Ring& ringForThisThread()
+    {
+        // Keyed by sink id rather than address, in case a sink is destroyed
+        // and another one is created at the same address.
+        thread_local std::unordered_map<uint64_t, std::shared_ptr<Ring>> rings;
+        auto &ring = rings[m_id];
+        if (ring == nullptr)
+        {
+            ring = std::make_shared<Ring>(m_ringSize);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_rings.push_back(ring);
+        }
+        return *ring;
+    }
+
+    void waitForSpace(Ring &ring, size_t needed)
+    {
+        size_t head = ring.head.load(std::memory_order_relaxed);
+        while (m_ringSize - (head - ring.tail.load(std::memory_order_acquire))
+            < needed)
+        {
+            if (m_flusherAsleep.load(std::memory_order_seq_cst))
+                wakeFlusher();
+            std::this_thread::yield();
+        }
+    }
+
+    void wakeFlusher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_linesWaiting = true;
+        }
+        m_wake.notify_one();
+    }
+
+    // Called with m_mutex held, after the flusher has announced it is going
+    // to sleep.
+    bool anyLinesWaiting() const
+    {
+        for (auto &ring : m_rings)
+        {
+            if (ring->head.load(std::memory_order_seq_cst) !=
+                ring->tail.load(std::memory_order_relaxed))
+                return true;
+        }
+        return false;
+    }
+
+    void copyIn(Ring &ring, size_t position, const char *data, size_t size)
+    {
+        size_t index = position & (m_ringSize - 1);
+        size_t first = std::min(size, m_ringSize - index);
+        std::memcpy(ring.data.get() + index, data, first);
+        std::memcpy(ring.data.get(), data + first, size - first);
+    }
+
+    void runFlusher()
+    {
+        std::string batch;
+        std::vector<std::shared_ptr<Ring>> rings;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;)
+        {
+            bool stopping = m_stopping;
+            uint64_t requests = m_flushRequests;
+            rings = m_rings;
+            lock.unlock();
+
+            // Held from draining until the batch is written, so a writer that
+            // sees its ring empty knows its lines are out.
+            batch.clear();
+            {
+                std::lock_guard<std::mutex> outLock(m_outMutex);
+                for (auto &ring : rings)
+                    drain(*ring, batch);
+                if (!batch.empty())
+                {
+                    std::fwrite(batch.data(), 1, batch.size(), m_out);
+                    std::fflush(m_out);
+                }
+            }
+
+            rings.clear();
+
+            lock.lock();
+            pruneFinishedThreads();
+            if (m_flushesDone < requests)
+            {
+                m_flushesDone = requests;
+                m_flushed.notify_all();
+            }
+            if (stopping)
+                return;
+            if (batch.empty())
+            {
+                // Any write after this either sees the flag and wakes us,
+                // or is seen by anyLinesWaiting and we do not sleep.
+                m_flusherAsleep.store(true, std::memory_order_seq_cst);
+                if (!anyLinesWaiting())
+                {
+                    m_wake.wait(lock, [&]() {
+                        return m_stopping || m_linesWaiting ||
+                            m_flushRequests != m_flushesDone; });
+                }
+                m_flusherAsleep.store(false, std::memory_order_relaxed);
+                m_linesWaiting = false;
+            }
+        }
+    }
+
+    // A ring only referenced by the sink belongs to a thread that has exited.
+    void pruneFinishedThreads()
+    {
+        m_rings.erase(std::remove_if(m_rings.begin(), m_rings.end(),
+            [](const std::shared_ptr<Ring> &ring)
+            {
+                return ring.use_count() == 1 &&
+                    ring->head.load(std::memory_order_acquire) ==
+                    ring->tail.load(std::memory_order_relaxed);
+            }), m_rings.end());
+    }
+
+    void drain(Ring &ring, std::string &batch)
+    {
+        size_t tail = ring.tail.load(std::memory_order_relaxed);
+        size_t head = ring.head.load(std::memory_order_acquire);
+        size_t size = head - tail;
+        if (size == 0)
+            return;
+
+        size_t index = tail & (m_ringSize - 1);
+        size_t first = std::min(size, m_ringSize - index);
+        batch.append(ring.data.get() + index, first);
+        batch.append(ring.data.get(), size - first);
+        ring.tail.store(head, std::memory_order_seq_cst);
+    }
+
+    std::FILE *m_out;
+    size_t m_ringSize;
+    uint64_t m_id;
+    std::mutex m_outMutex;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_flushed;
+    std::vector<std::shared_ptr<Ring>> m_rings;
+    uint64_t m_flushRequests{ 0 };
+    uint64_t m_flushesDone{ 0 };
+    bool m_linesWaiting{ false };
+    bool m_stopping{ false };
+    std::atomic<bool> m_flusherAsleep{ false };
+    std::thread m_flusher;
+};
+
+namespace log_detail
+{
+    inline std::atomic<ILogSink*>& currentSink()
+    {
+        static AsyncLogSink defaultSink;
+        static std::atomic<ILogSink*> sink{ &defaultSink };
+        return sink;
+    }
+
+    inline void append(std::string &line, std::string_view text)
+    {
+        line += text;
+    }
+
+    inline void append(std::string &line, char c)
+    {
+        line += c;
+    }
+
+    template <typename T,
+        typename = std::enable_if_t<std::is_integral<T>::value>>
+    void append(std::string &line, T value)
+    {
+        // std::to_chars is deleted for bool. Not a separate bool overload,
+        // which string literals would convert to ahead of std::string_view.
+        if constexpr (std::is_same<T, bool>::value)
+        {
+            line += value ? "true" : "false";
+        }
+        else
+        {
+            char digits[24];
+            auto result = std::to_chars(digits, digits + sizeof(digits),
+                value);
+            line.append(digits, result.ptr);
+        }
+    }
+}
+
+inline ILogSink& logSink()
+{
+    return *log_detail::currentSink().load(std::memory_order_acquire);
+}
+
+// The sink must outlive every write to it.
+inline void setLogSink(ILogSink &sink)
+{
+    log_detail::currentSink().store(&sink, std::memory_order_release);
+}
+
+// Formats the arguments into one line and writes it to the current sink.
+// Builds the line in a per-thread buffer, so it does not allocate once warm.
+template <typename... Args>
+void logLine(const Args&... args)
+{
+    thread_local std::string line;
+    line.clear();
+    (log_detail::append(line, args), ...);
+    logSink().write(line);
+}
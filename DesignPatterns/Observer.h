@@ -7,6 +7,9 @@
 #include <functional>
 #include <iostream>
 
+#include "Log.h"
+#include "Trace.h"
+
 class IObserver
 {
 public:
@@ -28,6 +31,7 @@ public:
 	void remove(IObserver &obs) override {}//remove the right observer
 	void notify() override
 	{
+		TRACE_SCOPE("observer", "WeatherStationObservable::notify");
 		for (auto const i : observers)
 			i.get().update();
 	}
@@ -41,8 +45,7 @@ public:
 		}
 		else
 		{
-			std::cout << "Temperature still the same, observers not notified."
-				<< std::endl;
+			logLine("Temperature still the same, observers not notified.");
 		}
 	}
 
@@ -63,8 +66,7 @@ public:
 
 	void update() const override
 	{
-		std::cout << "Phone got new temperature of " << wso.getTemperature()
-			<< std::endl;
+		logLine("Phone got new temperature of ", wso.getTemperature());
 	}
 
 private:
@@ -78,8 +80,7 @@ public:
 
 	void update() const override
 	{
-		std::cout << "TV got new temperature of " << wso.getTemperature()
-			<< std::endl;
+		logLine("TV got new temperature of ", wso.getTemperature());
 	}
 
 private:
@@ -104,6 +105,7 @@ inline void ObserverDemo()
 			<< std::endl;
 		std::cin >> temp;
 		wsObservable.setTemperature(temp);
+		logSink().flush();
 		std::cout << std::endl;
 	} while (temp != -1);
 }
\ No newline at end of file
@@ -0,0 +1,173 @@
+#pragma once
+// A Protection Proxy for IBookParser (see Proxy.h for the other proxy styles).
+// Each ProtectedBookParserProxy acts for one user, and only forwards calls to
+// the real parser if the access policy allows that user in.
+
+// Evaluating a policy can be expensive, so decisions are remembered in an
+// AccessDecisionCache. A cache hit is a single atomic load with no lock. Every
+// policy change bumps the policy's epoch, which invalidates every decision
+// cached before it at once.
+
+#include "Proxy.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_set>
+#include <vector>
+
+class IAccessPolicy
+{
+public:
+    virtual ~IAccessPolicy() {}
+    virtual bool isAllowed(uint32_t userId) = 0;
+
+    uint32_t epoch() const
+    {
+        return m_epoch.load(std::memory_order_acquire);
+    }
+
+protected:
+    // Must be called after every change to the policy's rules.
+    void policyChanged()
+    {
+        m_epoch.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+private:
+    std::atomic<uint32_t> m_epoch{ 1 };
+};
+
+// Only users on the list are allowed.
+class AllowListPolicy : public IAccessPolicy
+{
+public:
+    bool isAllowed(uint32_t userId) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_allowed.count(userId) != 0;
+    }
+
+    void allow(uint32_t userId)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_allowed.insert(userId);
+        }
+        policyChanged();
+    }
+
+    void revoke(uint32_t userId)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_allowed.erase(userId);
+        }
+        policyChanged();
+    }
+
+private:
+    std::mutex m_mutex;
+    std::unordered_set<uint32_t> m_allowed;
+};
+
+// A direct mapped table of decisions for one policy. Each slot packs the user
+// id, the policy epoch the decision was made in and the decision itself into
+// one 64 bit word, so reading and writing a slot never needs a lock. Two users
+// sharing a slot just evict each other, which costs a re-evaluation but never
+// a wrong answer.
+class AccessDecisionCache
+{
+public:
+    AccessDecisionCache(IAccessPolicy &policy, size_t numSlots = 4096)
+        : m_policy(policy), m_slots(roundUpToPowerOfTwo(numSlots))
+    {
+    }
+
+    bool isAllowed(uint32_t userId)
+    {
+        // The epoch is read before the policy is evaluated, so a decision
+        // that races with a policy change is stored under the old epoch and
+        // never used.
+        uint32_t epoch = m_policy.epoch() & EPOCH_MASK;
+        std::atomic<uint64_t> &slot = m_slots[slotFor(userId)];
+        uint64_t entry = slot.load(std::memory_order_acquire);
+        if (entry != 0 && (entry >> 32) == userId &&
+            ((entry >> 1) & EPOCH_MASK) == epoch)
+            return (entry & 1) != 0;
+
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        bool allowed = m_policy.isAllowed(userId);
+        slot.store((uint64_t(userId) << 32) | (uint64_t(epoch) << 1) |
+            (allowed ? 1 : 0), std::memory_order_release);
+        return allowed;
+    }
+
+    // Only misses are counted: a counter bumped on every hit would be a
+    // shared write on the lock free path, and the readers of the hot
+    // entries would all contend on its cache line.
+    uint64_t misses() const
+    {
+        return m_misses.load(std::memory_order_relaxed);
+    }
+
+private:
+    // 31 bits of the epoch fit in a slot. After 2^31 policy changes an old
+    // decision could look current again, which is far beyond any real use.
+    static constexpr uint32_t EPOCH_MASK = 0x7FFFFFFF;
+
+    static size_t roundUpToPowerOfTwo(size_t n)
+    {
+        size_t size = 1;
+        while (size < n)
+            size <<= 1;
+        return size;
+    }
+
+    size_t slotFor(uint32_t userId) const
+    {
+        // Fibonacci hashing spreads sequential ids over the table.
+        uint64_t hash = uint64_t(userId) * 11400714819323198485ull;
+        return static_cast<size_t>(hash >> 32) & (m_slots.size() - 1);
+    }
+
+    IAccessPolicy &m_policy;
+    std::vector<std::atomic<uint64_t>> m_slots;
+    std::atomic<uint64_t> m_misses{ 0 };
+};
+
+class AccessDeniedError : public std::runtime_error
+{
+public:
+    AccessDeniedError(uint32_t userId)
+        : std::runtime_error("User " + std::to_string(userId) +
+            " is not allowed to access this book."), m_userId(userId) {}
+
+    uint32_t userId() const { return m_userId; }
+
+private:
+    uint32_t m_userId;
+};
+
+class ProtectedBookParserProxy : public IBookParser
+{
+public:
+    ProtectedBookParserProxy(IBookParser &bookParser,
+        AccessDecisionCache &access, uint32_t userId)
+        : m_bookParser(bookParser), m_access(access), m_userId(userId) {}
+
+    // Throws AccessDeniedError if the user is not allowed.
+    int getNumPages() override
+    {
+        TRACE_SCOPE("proxy", "ProtectedBookParserProxy::getNumPages");
+        if (!m_access.isAllowed(m_userId))
+            throw AccessDeniedError(m_userId);
+        return m_bookParser.getNumPages();
+    }
+
+private:
+    IBookParser &m_bookParser;
+    AccessDecisionCache &m_access;
+    uint32_t m_userId;
+};
@@ -6,12 +6,14 @@
 // - Remote Proxy
 //   - To be used when a resource that is remote needs to be accesed. e.g.
 //     a different namespace, a server, a different code project.
+//   - See RemoteProxy.h.
 // - Virtual Proxy
 //   - A virtual proxy controls access to a resource that is expensive to 
 //     create.
 // - Protection Proxy
 //   - It controls access to a resource based on access rights. Only users who
 //     are allowed to access the resource will be granted access.
+//   - See ProtectionProxy.h.
 
 // The following code will be for a Virtual Proxy, very contrived example 
 // because there are definitely better ways to implement the following; but it's
@@ -20,50 +22,879 @@
 #include <string>
 #include <memory>
 #include <iostream>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <istream>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Log.h"
+#include "Trace.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BOOK_PARSER_SSE2
+#include <emmintrin.h>
+#endif
+
+// A read only file mapped into memory, so a book can be parsed straight from
+// the page cache without ever being copied into a std::string.
+class MappedFile
+{
+public:
+    MappedFile(const std::string &path)
+    {
+#ifdef _WIN32
+        m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_file == INVALID_HANDLE_VALUE)
+            throwLastError("CreateFile");
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(m_file, &size))
+            throwLastError("GetFileSizeEx");
+        m_size = static_cast<size_t>(size.QuadPart);
+        if (m_size == 0)
+            return;
+        m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0,
+            nullptr);
+        if (m_mapping == nullptr)
+            throwLastError("CreateFileMapping");
+        m_data = static_cast<const char*>(
+            MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+        if (m_data == nullptr)
+            throwLastError("MapViewOfFile");
+#else
+        m_fd = open(path.c_str(), O_RDONLY);
+        if (m_fd < 0)
+            throwLastError("open");
+        struct stat info;
+        if (fstat(m_fd, &info) != 0)
+            throwLastError("fstat");
+        m_size = static_cast<size_t>(info.st_size);
+        if (m_size == 0)
+            return;
+        void *data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+        if (data == MAP_FAILED)
+            throwLastError("mmap");
+        m_data = static_cast<const char*>(data);
+        // The whole file is about to be scanned front to back.
+        madvise(data, m_size, MADV_SEQUENTIAL);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+        release();
+    }
+
+    std::string_view view() const
+    {
+        return std::string_view(m_data, m_data == nullptr ? 0 : m_size);
+    }
+
+private:
+    void release()
+    {
+#ifdef _WIN32
+        if (m_data != nullptr)
+            UnmapViewOfFile(m_data);
+        if (m_mapping != nullptr)
+            CloseHandle(m_mapping);
+        if (m_file != INVALID_HANDLE_VALUE)
+            CloseHandle(m_file);
+#else
+        if (m_data != nullptr)
+            munmap(const_cast<char*>(m_data), m_size);
+        if (m_fd >= 0)
+            close(m_fd);
+#endif
+    }
+
+    [[noreturn]] void throwLastError(const char *what)
+    {
+#ifdef _WIN32
+        int error = static_cast<int>(GetLastError());
+#else
+        int error = errno;
+#endif
+        release();
+        throw std::system_error(error, std::system_category(), what);
+    }
+
+    const char *m_data{ nullptr };
+    size_t m_size{ 0 };
+#ifdef _WIN32
+    HANDLE m_file{ INVALID_HANDLE_VALUE };
+    HANDLE m_mapping{ nullptr };
+#else
+    int m_fd{ -1 };
+#endif
+};
+
+// 64 bit FNV-1a hash of a book's contents. It is stable between runs and
+// processes, unlike std::hash.
+inline uint64_t hashBook(std::string_view book)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : book)
+    {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// The contents of a book, wherever they live. Proxies and parsers share one
+// BookSource and only ever look at it through a std::string_view, so a book is
+// never copied once it has been loaded.
+class BookSource
+{
+public:
+    // Takes ownership of an in memory book.
+    static std::shared_ptr<const BookSource> fromString(std::string book)
+    {
+        auto source = std::shared_ptr<BookSource>(new BookSource());
+        source->m_owned = std::move(book);
+        source->m_view = source->m_owned;
+        return source;
+    }
+
+    // Does not take ownership, the caller keeps the memory alive for as long
+    // as any proxy or parser uses it.
+    static std::shared_ptr<const BookSource> fromView(std::string_view book)
+    {
+        auto source = std::shared_ptr<BookSource>(new BookSource());
+        source->m_view = book;
+        return source;
+    }
+
+    // Memory maps the file, so only the pages actually read are loaded. The
+    // modification time is read before mapping, so a write that lands while
+    // the book is being read leaves it looking out of date.
+    static std::shared_ptr<const BookSource> fromFile(const std::string &path)
+    {
+        auto source = std::shared_ptr<BookSource>(new BookSource());
+        std::error_code error;
+        auto modified = std::filesystem::last_write_time(path, error);
+        if (!error)
+        {
+            source->m_modified = static_cast<int64_t>(
+                modified.time_since_epoch().count());
+        }
+        source->m_mapped = std::make_unique<MappedFile>(path);
+        source->m_view = source->m_mapped->view();
+        source->m_path = path;
+        return source;
+    }
+
+    std::string_view view() const { return m_view; }
+
+    // Empty unless the book was loaded from a file.
+    const std::string& path() const { return m_path; }
+
+    // The file's modification time from just before it was mapped, or 0.
+    int64_t modified() const { return m_modified; }
+
+    // hashBook() of the contents. Computed on first use and then kept, so
+    // looking the same book up again does not read it again.
+    uint64_t contentHash() const
+    {
+        std::call_once(m_hashOnce, [this]() { m_hash = hashBook(m_view); });
+        return m_hash;
+    }
+
+private:
+    BookSource() = default;
+
+    std::string m_path;
+    int64_t m_modified{ 0 };
+    std::string m_owned;
+    std::unique_ptr<MappedFile> m_mapped;
+    std::string_view m_view;
+    mutable std::once_flag m_hashOnce;
+    mutable uint64_t m_hash{ 0 };
+};
 
 class IBookParser
 {
 public:
+    virtual ~IBookParser() {}
     virtual int getNumPages() = 0;
 };
 
-class BookParser : IBookParser
+// How a book is split into pages: a form feed ('\f') always starts a new page,
+// and a page that reaches LINES_PER_PAGE newlines starts a new page with the
+// next line. A non empty book has one page plus one per page break, not
+// counting a break on the very last byte.
+constexpr uint64_t LINES_PER_PAGE = 50;
+
+// What a contiguous piece of a book contributes to the page count. Nothing in
+// it depends on what came before the piece, so pieces can be scanned in any
+// order (or in parallel) and merged afterwards, in order, to an exact count.
+struct PageScan
+{
+    uint64_t size{ 0 };
+    uint64_t formFeeds{ 0 };
+    uint64_t leadNewlines{ 0 };  // Before the first form feed.
+    uint64_t innerBreaks{ 0 };   // Line breaks between the form feeds.
+    uint64_t tailNewlines{ 0 };  // After the last form feed.
+    char lastByte{ 0 };
+};
+
+class PageCounter
+{
+public:
+    // Feeds the next piece of the book, pieces must arrive in order. Only a
+    // running total is kept, so books larger than memory can be streamed.
+    void feed(std::string_view piece)
+    {
+        merge(scan(piece));
+    }
+
+    void merge(const PageScan &scan)
+    {
+        if (scan.size == 0)
+            return;
+
+        m_carry += scan.leadNewlines;
+        if (scan.formFeeds > 0)
+        {
+            m_breaks += m_carry / LINES_PER_PAGE + scan.formFeeds +
+                scan.innerBreaks;
+            m_carry = scan.tailNewlines;
+        }
+        m_size += scan.size;
+        m_lastByte = scan.lastByte;
+    }
+
+    uint64_t numPages() const
+    {
+        if (m_size == 0)
+            return 0;
+        uint64_t breaks = m_breaks + m_carry / LINES_PER_PAGE;
+        bool endsOnBreak = m_carry % LINES_PER_PAGE == 0 &&
+            (m_lastByte == '\n' || m_lastByte == '\f');
+        return 1 + breaks - (endsOnBreak ? 1 : 0);
+    }
+
+    static PageScan scan(std::string_view piece, bool vectorized = true)
+    {
+        ScanState state;
+        size_t i = 0;
+#ifdef BOOK_PARSER_SSE2
+        if (vectorized)
+        {
+            const __m128i newline = _mm_set1_epi8('\n');
+            const __m128i formFeed = _mm_set1_epi8('\f');
+            for (; i + 16 <= piece.size(); i += 16)
+            {
+                __m128i block = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(piece.data() + i));
+                unsigned newlines = static_cast<unsigned>(_mm_movemask_epi8(
+                    _mm_cmpeq_epi8(block, newline)));
+                unsigned formFeeds = static_cast<unsigned>(_mm_movemask_epi8(
+                    _mm_cmpeq_epi8(block, formFeed)));
+
+                // Form feeds are rare, so almost every block is one popcount.
+                while (formFeeds != 0)
+                {
+                    unsigned before = (formFeeds & (0u - formFeeds)) - 1;
+                    state.current += popcount(newlines & before);
+                    newlines &= ~before;
+                    formFeeds &= formFeeds - 1;
+                    state.closeSegment();
+                }
+                state.current += popcount(newlines);
+            }
+        }
+#else
+        (void)vectorized;
+#endif
+        for (; i < piece.size(); ++i)
+        {
+            if (piece[i] == '\n')
+                ++state.current;
+            else if (piece[i] == '\f')
+                state.closeSegment();
+        }
+
+        PageScan result = state.result;
+        if (result.formFeeds == 0)
+            result.leadNewlines = state.current;
+        else
+            result.tailNewlines = state.current;
+        result.size = piece.size();
+        result.lastByte = piece.empty() ? 0 : piece.back();
+        return result;
+    }
+
+    // Splits the book into blocks, scans them on up to numThreads threads (0
+    // uses every hardware thread) and merges the results in order. Gives up
+    // and returns nothing once cancelled is set, which is checked before
+    // every block, so a cancelled count stops within a block's scan.
+    static std::optional<uint64_t> countPages(std::string_view book,
+        const std::atomic<bool> &cancelled, unsigned numThreads = 0)
+    {
+        const size_t blockSize = 1 << 20;
+        const size_t numBlocks = book.size() / blockSize + 1;
+        if (numThreads == 0)
+            numThreads = std::max(1u, std::thread::hardware_concurrency());
+        numThreads = static_cast<unsigned>(
+            std::min<size_t>(numThreads, numBlocks));
+
+        std::vector<PageScan> scans(numBlocks);
+        std::atomic<size_t> next{ 0 };
+        auto scanBlocks = [&]()
+        {
+            for (size_t b = next++; b < numBlocks; b = next++)
+            {
+                if (cancelled.load(std::memory_order_relaxed))
+                    return;
+                scans[b] = scan(book.substr(b * blockSize, blockSize));
+            }
+        };
+        std::vector<std::future<void>> workers;
+        for (unsigned t = 1; t < numThreads; ++t)
+            workers.push_back(std::async(std::launch::async, scanBlocks));
+        scanBlocks();
+        for (auto &worker : workers)
+            worker.get();
+        if (cancelled.load(std::memory_order_relaxed))
+            return std::nullopt;
+
+        PageCounter counter;
+        for (auto &blockScan : scans)
+            counter.merge(blockScan);
+        return counter.numPages();
+    }
+
+    static uint64_t countPages(std::string_view book, unsigned numThreads = 0)
+    {
+        const std::atomic<bool> never{ false };
+        return *countPages(book, never, numThreads);
+    }
+
+    // Streams the book through a fixed size buffer.
+    static uint64_t countPages(std::istream &book,
+        size_t bufferSize = 1 << 20)
+    {
+        PageCounter counter;
+        std::vector<char> buffer(bufferSize);
+        while (book)
+        {
+            book.read(buffer.data(), static_cast<std::streamsize>(bufferSize));
+            counter.feed(std::string_view(buffer.data(),
+                static_cast<size_t>(book.gcount())));
+        }
+        return counter.numPages();
+    }
+
+private:
+    struct ScanState
+    {
+        PageScan result;
+        uint64_t current{ 0 };
+
+        void closeSegment()
+        {
+            if (result.formFeeds == 0)
+                result.leadNewlines = current;
+            else
+                result.innerBreaks += current / LINES_PER_PAGE;
+            ++result.formFeeds;
+            current = 0;
+        }
+    };
+
+    static unsigned popcount(unsigned bits)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return static_cast<unsigned>(__builtin_popcount(bits));
+#else
+        unsigned count = 0;
+        for (; bits != 0; bits &= bits - 1)
+            ++count;
+        return count;
+#endif
+    }
+
+    uint64_t m_breaks{ 0 };
+    uint64_t m_carry{ 0 };  // Newlines since the last form feed.
+    uint64_t m_size{ 0 };
+    char m_lastByte{ 0 };
+};
+
+// A small index file stored next to a book (book.txt -> book.txt.pageidx)
+// which remembers the parse results, so a restarted process does not have to
+// parse the book again. The index is trusted as is while the book's size and
+// modification time are unchanged. If only the time changed, the content hash
+// decides whether the index is still valid.
+class BookIndex
+{
+public:
+    static std::string pathFor(const std::string &bookPath)
+    {
+        return bookPath + ".pageidx";
+    }
+
+    // Returns the indexed page count of a book loaded from a file, or
+    // nothing if there is no valid index.
+    static std::optional<uint64_t> load(const BookSource &book)
+    {
+        Record record;
+        std::ifstream in(pathFor(book.path()), std::ios::binary);
+        if (!in.read(reinterpret_cast<char*>(&record), sizeof(record)))
+            return std::nullopt;
+        if (std::memcmp(record.magic, MAGIC, sizeof(record.magic)) != 0 ||
+            record.version != VERSION || record.checksum != checksum(record) ||
+            record.linesPerPage != LINES_PER_PAGE ||
+            record.sourceSize != book.view().size())
+            return std::nullopt;
+
+        if (record.sourceModified != book.modified())
+        {
+            if (record.contentHash != book.contentHash())
+                return std::nullopt;
+            in.close();
+            write(book, record.numPages);
+        }
+        return record.numPages;
+    }
+
+    // Best effort, a book in a read only directory simply stays unindexed.
+    // Records the size and modification time of what was actually parsed,
+    // not of the file as it is now.
+    static void save(const BookSource &book, uint64_t numPages)
+    {
+        write(book, numPages);
+    }
+
+private:
+    struct Record
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t linesPerPage;
+        uint64_t sourceSize;
+        int64_t sourceModified;
+        uint64_t contentHash;
+        uint64_t numPages;
+        uint64_t checksum; // Of every field above.
+    };
+
+    static constexpr char MAGIC[4] = { 'D', 'P', 'B', 'I' };
+    static constexpr uint32_t VERSION = 1;
+
+    static uint64_t checksum(const Record &record)
+    {
+        return hashBook(std::string_view(reinterpret_cast<const char*>(
+            &record), offsetof(Record, checksum)));
+    }
+
+    static void write(const BookSource &book, uint64_t numPages)
+    {
+        Record record{};
+        std::memcpy(record.magic, MAGIC, sizeof(record.magic));
+        record.version = VERSION;
+        record.linesPerPage = LINES_PER_PAGE;
+        record.sourceSize = book.view().size();
+        record.sourceModified = book.modified();
+        record.contentHash = book.contentHash();
+        record.numPages = numPages;
+        record.checksum = checksum(record);
+
+        // Write then rename, so readers never see a half written index.
+        const std::string &bookPath = book.path();
+        std::error_code error;
+        std::string temp = pathFor(bookPath) + ".tmp";
+        {
+            std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+            if (!out.write(reinterpret_cast<const char*>(&record),
+                sizeof(record)))
+                return;
+        }
+        std::filesystem::rename(temp, pathFor(bookPath), error);
+        if (error)
+            std::filesystem::remove(temp, error);
+    }
+};
+
+class BookParser : public IBookParser
 {
 public:
+    // Parses the book, unless it is a file with a valid BookIndex in which
+    // case the indexed results are reused without reading the book at all.
+    static std::unique_ptr<BookParser> create(const BookSource &source)
+    {
+        const std::atomic<bool> never{ false };
+        return create(source, never);
+    }
+
+    // As above, but gives up and returns nullptr once cancelled is set.
+    static std::unique_ptr<BookParser> create(const BookSource &source,
+        const std::atomic<bool> &cancelled)
+    {
+        if (!source.path().empty())
+        {
+            auto numPages = BookIndex::load(source);
+            if (numPages)
+                return std::unique_ptr<BookParser>(new BookParser(*numPages));
+        }
+
+        auto numPages = PageCounter::countPages(source.view(), cancelled);
+        if (!numPages)
+            return nullptr;
+        logLine("This is a very expensive constructor initialization.");
+        if (!source.path().empty())
+            BookIndex::save(source, *numPages);
+        return std::unique_ptr<BookParser>(new BookParser(*numPages));
+    }
+
     // Let's say the book string contains the contents of a whole book. In other
-    // words, it's a HUGE string.
-    BookParser(std::string book)
+    // words, it's a HUGE string, so it is only ever looked at through a view.
+    BookParser(std::string_view book)
+        : m_numPages(PageCounter::countPages(book))
     {
         // Some very expensive process to initialize the BookParser.
-        std::cout << "This is a very expensive constructor initialization."
-            << std::endl;
+        logLine("This is a very expensive constructor initialization.");
+    }
+
+    // For books that do not fit in memory.
+    BookParser(std::istream &book)
+        : m_numPages(PageCounter::countPages(book))
+    {
+        logLine("This is a very expensive constructor initialization.");
     }
 
     int getNumPages() override
     {
+        TRACE_SCOPE("proxy", "BookParser::getNumPages");
         // Some simple operation, which relies on the constructor being 
         // initialized first.
-        std::cout << "There is a cheap operation to get the number of pages."
-            << std::endl;
-        return 0;
+        logLine("There is a cheap operation to get the number of pages.");
+        return static_cast<int>(std::min<uint64_t>(m_numPages, INT_MAX));
     }
+
+private:
+    explicit BookParser(uint64_t numPages) : m_numPages(numPages) {}
+
+    uint64_t m_numPages{ 0 };
 };
 
-class LazyBookParserProxy : IBookParser
+class LazyBookParserProxy : public IBookParser
 {
 public:
-    LazyBookParserProxy(std::string book) : m_book(book) {}
+    LazyBookParserProxy(std::string book)
+        : m_book(BookSource::fromString(std::move(book))) {}
+    LazyBookParserProxy(std::shared_ptr<const BookSource> book)
+        : m_book(std::move(book)) {}
+    LazyBookParserProxy(const LazyBookParserProxy&) = delete;
+    LazyBookParserProxy& operator=(const LazyBookParserProxy&) = delete;
+
+    ~LazyBookParserProxy()
+    {
+        // A running prefetch stops at its next block, so this only waits for
+        // the blocks being scanned right now.
+        m_cancelled = true;
+        if (m_pending.valid())
+            m_pending.wait();
+    }
+
+    // Hint that getNumPages() will be needed soon. The BookParser starts being
+    // built on a background thread, so the first real call only waits for
+    // whatever part of the construction is left.
+    void prefetch()
+    {
+        if (m_bookParser != nullptr || m_pending.valid())
+            return;
+
+        m_pending = std::async(std::launch::async,
+            [this]() { return BookParser::create(*m_book, m_cancelled); });
+    }
 
     int getNumPages() override
     {
+        TRACE_SCOPE("proxy", "LazyBookParserProxy::getNumPages");
         if (m_bookParser == nullptr)
-            m_bookParser = std::make_unique<BookParser>(m_book);
+        {
+            if (m_pending.valid())
+                m_bookParser = m_pending.get();
+            else
+                m_bookParser = BookParser::create(*m_book);
+        }
         return m_bookParser->getNumPages();
     }
 
 private:
-    std::string m_book;
+    std::shared_ptr<const BookSource> m_book;
     std::unique_ptr<BookParser> m_bookParser{ nullptr };
+    std::future<std::unique_ptr<BookParser>> m_pending;
+    std::atomic<bool> m_cancelled{ false };
+};
+
+// LazyBookParserProxy must not be shared between threads: two threads calling
+// getNumPages() at once can both see a null m_bookParser and build the parser
+// twice. This variant builds it exactly once using double checked locking.
+// Once the parser exists, every call is a single acquire load with no lock.
+class ConcurrentLazyBookParserProxy : public IBookParser
+{
+public:
+    ConcurrentLazyBookParserProxy(std::string book)
+        : m_book(BookSource::fromString(std::move(book))) {}
+    ConcurrentLazyBookParserProxy(std::shared_ptr<const BookSource> book)
+        : m_book(std::move(book)) {}
+    ConcurrentLazyBookParserProxy(const ConcurrentLazyBookParserProxy&) =
+        delete;
+    ConcurrentLazyBookParserProxy& operator=(
+        const ConcurrentLazyBookParserProxy&) = delete;
+
+    int getNumPages() override
+    {
+        TRACE_SCOPE("proxy", "ConcurrentLazyBookParserProxy::getNumPages");
+        return parser()->getNumPages();
+    }
+
+private:
+    BookParser* parser()
+    {
+        BookParser *parser = m_parser.load(std::memory_order_acquire);
+        if (parser != nullptr)
+            return parser;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        parser = m_parser.load(std::memory_order_relaxed);
+        if (parser == nullptr)
+        {
+            m_bookParser = BookParser::create(*m_book);
+            parser = m_bookParser.get();
+            m_parser.store(parser, std::memory_order_release);
+        }
+        return parser;
+    }
+
+    std::shared_ptr<const BookSource> m_book;
+    std::atomic<BookParser*> m_parser{ nullptr };
+    std::mutex m_mutex;
+    std::unique_ptr<BookParser> m_bookParser{ nullptr };
+};
+
+// A process wide cache of parsed books, so proxies for the same book content
+// share one BookParser instead of each parsing it again. Entries are keyed by
+// content hash and size, and evicted least recently used first once the
+// memory budget is exceeded. The cache is split into independently locked
+// shards so unrelated books do not contend with each other.
+class BookParserCache
+{
+public:
+    struct Stats
+    {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        size_t bytes;
+        size_t entries;
+    };
+
+    BookParserCache(size_t budgetBytes, size_t numShards = 16)
+        : m_shards(numShards == 0 ? 1 : numShards),
+        m_shardBudget(budgetBytes / m_shards.size())
+    {
+    }
+
+    BookParserCache(const BookParserCache&) = delete;
+    BookParserCache& operator=(const BookParserCache&) = delete;
+
+    static BookParserCache& instance()
+    {
+        static BookParserCache cache(256 * 1024 * 1024);
+        return cache;
+    }
+
+    // Returns the cached parser for this book, building it with
+    // BookParser::create() on a miss, so a book loaded from a file uses and
+    // updates its BookIndex. The returned parser stays valid even if the
+    // cache evicts it later. Reuses the source's content hash, so a hit does
+    // not read the book.
+    std::shared_ptr<BookParser> get(const BookSource &book)
+    {
+        return get(book, book.contentHash());
+    }
+
+    // Hashes the whole book first, prefer get(const BookSource&).
+    std::shared_ptr<BookParser> get(std::string_view book)
+    {
+        return get(*BookSource::fromView(book), hashBook(book));
+    }
+
+    // Bytes a cached parser really costs: the parser itself, the LRU list
+    // node holding it, the index node and bucket pointing at that node, and
+    // the shared_ptr control block.
+    static constexpr size_t entryBytes()
+    {
+        return sizeof(BookParser) + (sizeof(Entry) + 2 * sizeof(void*)) +
+            (sizeof(std::pair<const uint64_t, std::list<Entry>::iterator>) +
+            2 * sizeof(void*)) + (sizeof(void*) + 2 * sizeof(int));
+    }
+
+    Stats stats()
+    {
+        Stats stats{};
+        stats.hits = m_hits.load(std::memory_order_relaxed);
+        stats.misses = m_misses.load(std::memory_order_relaxed);
+        stats.evictions = m_evictions.load(std::memory_order_relaxed);
+        for (auto &shard : m_shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            stats.bytes += shard.bytes;
+            stats.entries += shard.lru.size();
+        }
+        return stats;
+    }
+
+    void clear()
+    {
+        for (auto &shard : m_shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.lru.clear();
+            shard.index.clear();
+            shard.bytes = 0;
+        }
+    }
+
+private:
+    std::shared_ptr<BookParser> get(const BookSource &source, uint64_t hash)
+    {
+        std::string_view book = source.view();
+        Shard &shard = m_shards[hash % m_shards.size()];
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto found = shard.index.find(hash);
+            if (found != shard.index.end() &&
+                found->second->bookSize == book.size())
+            {
+                shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+                m_hits.fetch_add(1, std::memory_order_relaxed);
+                return found->second->parser;
+            }
+        }
+
+        // Parse without holding the shard lock. Two threads missing on the
+        // same book at once may both parse it; the first insert wins.
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        std::shared_ptr<BookParser> parser = BookParser::create(source);
+        size_t bytes = entryBytes();
+        if (bytes > m_shardBudget)
+            return parser;
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto found = shard.index.find(hash);
+        if (found != shard.index.end())
+        {
+            if (found->second->bookSize == book.size())
+            {
+                shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+                return found->second->parser;
+            }
+            // Hash collision with a different book, the newer one replaces it.
+            shard.bytes -= found->second->bytes;
+            shard.lru.erase(found->second);
+            shard.index.erase(found);
+        }
+
+        shard.lru.push_front({ hash, book.size(), bytes, parser });
+        shard.index[hash] = shard.lru.begin();
+        shard.bytes += bytes;
+        while (shard.bytes > m_shardBudget)
+        {
+            Entry &victim = shard.lru.back();
+            shard.bytes -= victim.bytes;
+            shard.index.erase(victim.hash);
+            shard.lru.pop_back();
+            m_evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+        return parser;
+    }
+
+    struct Entry
+    {
+        uint64_t hash;
+        size_t bookSize;
+        size_t bytes;
+        std::shared_ptr<BookParser> parser;
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::list<Entry> lru; // Most recently used first.
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+        size_t bytes{ 0 };
+    };
+
+    std::vector<Shard> m_shards;
+    size_t m_shardBudget;
+    std::atomic<uint64_t> m_hits{ 0 };
+    std::atomic<uint64_t> m_misses{ 0 };
+    std::atomic<uint64_t> m_evictions{ 0 };
+};
+
+// A virtual proxy which pulls its BookParser from a BookParserCache on first
+// use, so every proxy over the same book shares a single parse.
+class CachedBookParserProxy : public IBookParser
+{
+public:
+    CachedBookParserProxy(std::string book,
+        BookParserCache &cache = BookParserCache::instance())
+        : m_book(BookSource::fromString(std::move(book))), m_cache(cache) {}
+    CachedBookParserProxy(std::shared_ptr<const BookSource> book,
+        BookParserCache &cache = BookParserCache::instance())
+        : m_book(std::move(book)), m_cache(cache) {}
+
+    int getNumPages() override
+    {
+        TRACE_SCOPE("proxy", "CachedBookParserProxy::getNumPages");
+        if (m_bookParser == nullptr)
+            m_bookParser = m_cache.get(*m_book);
+        return m_bookParser->getNumPages();
+    }
+
+private:
+    std::shared_ptr<const BookSource> m_book;
+    BookParserCache &m_cache;
+    std::shared_ptr<BookParser> m_bookParser{ nullptr };
 };
 
 void VirtualProxyDemo()
@@ -77,6 +908,7 @@ void VirtualProxyDemo()
     std::cin.ignore();
     std::getline(std::cin, temp);
     bpp.getNumPages();
+    logSink().flush();
     std::cout << "Enter any value to exit." << std::endl;
     std::getline(std::cin, temp);
 }
\ No newline at end of file
@@ -0,0 +1,517 @@
+#pragma once
+// A Remote Proxy for IBookParser (see Proxy.h for the other proxy styles).
+// Books are parsed by a separate parser service, and RemoteBookParserProxy
+// looks like any other IBookParser while forwarding every call to it over a
+// Unix domain socket.
+
+// Each connection is pipelined: any number of requests can be in flight at
+// once, requests queued while a send is in progress go out together in the
+// next send, and responses are matched back to their callers by request id.
+// Connections are shared through a RemoteBookParserPool.
+
+// Wire format, in host byte order since both ends are on the same machine:
+// - Request:  u32 payload size, u32 request id, u8 opcode, payload (book path)
+// - Response: u32 request id, u8 status, i32 number of pages
+
+// Unix domain sockets are only used on POSIX systems, so on Windows this
+// header is empty.
+#ifndef _WIN32
+
+#include "Proxy.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+enum class REMOTE_BOOK_OP : uint8_t
+{
+    GET_NUM_PAGES = 1
+};
+
+enum class REMOTE_BOOK_STATUS : uint8_t
+{
+    OK = 0,
+    FAILED = 1
+};
+
+constexpr size_t REMOTE_BOOK_REQUEST_HEADER = 9;
+constexpr size_t REMOTE_BOOK_RESPONSE_SIZE = 9;
+constexpr uint32_t REMOTE_BOOK_MAX_PAYLOAD = 64 * 1024;
+
+namespace remote_book_detail
+{
+    inline sockaddr_un socketAddress(const std::string &socketPath)
+    {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (socketPath.size() >= sizeof(address.sun_path))
+            throw std::invalid_argument("Socket path is too long.");
+        std::memcpy(address.sun_path, socketPath.c_str(),
+            socketPath.size() + 1);
+        return address;
+    }
+
+    inline bool sendAll(int fd, const char *data, size_t size)
+    {
+#ifdef MSG_NOSIGNAL
+        const int flags = MSG_NOSIGNAL;
+#else
+        const int flags = 0;
+#endif
+        while (size > 0)
+        {
+            ssize_t sent = send(fd, data, size, flags);
+            if (sent < 0 && errno == EINTR)
+                continue;
+            if (sent <= 0)
+                return false;
+            data += sent;
+            size -= static_cast<size_t>(sent);
+        }
+        return true;
+    }
+
+    template <typename T>
+    void append(std::string &buffer, T value)
+    {
+        buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    template <typename T>
+    T read(const char *data)
+    {
+        T value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+}
+
+// One pipelined connection to a parser service.
+class RemoteBookParserConnection
+{
+public:
+    RemoteBookParserConnection(const std::string &socketPath)
+    {
+        m_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (m_fd < 0)
+            throw std::system_error(errno, std::system_category(), "socket");
+        sockaddr_un address = remote_book_detail::socketAddress(socketPath);
+        if (connect(m_fd, reinterpret_cast<sockaddr*>(&address),
+            sizeof(address)) != 0)
+        {
+            int error = errno;
+            close(m_fd);
+            throw std::system_error(error, std::system_category(), "connect");
+        }
+        m_reader = std::thread([this]() { readResponses(); });
+    }
+
+    RemoteBookParserConnection(const RemoteBookParserConnection&) = delete;
+    RemoteBookParserConnection& operator=(
+        const RemoteBookParserConnection&) = delete;
+
+    ~RemoteBookParserConnection()
+    {
+        shutdown(m_fd, SHUT_RDWR);
+        m_reader.join();
+        close(m_fd);
+    }
+
+    std::future<int> getNumPagesAsync(const std::string &bookPath)
+    {
+        if (bookPath.size() > REMOTE_BOOK_MAX_PAYLOAD)
+            throw std::invalid_argument("Book path is too long.");
+
+        std::promise<int> promise;
+        std::future<int> result = promise.get_future();
+        uint32_t id;
+        {
+            std::lock_guard<std::mutex> lock(m_pendingMutex);
+            if (m_closed)
+                throw std::runtime_error("Parser service connection closed.");
+            id = m_nextId++;
+            m_pending.emplace(id, std::move(promise));
+        }
+
+        std::string frame;
+        frame.reserve(REMOTE_BOOK_REQUEST_HEADER + bookPath.size());
+        remote_book_detail::append(frame,
+            static_cast<uint32_t>(bookPath.size()));
+        remote_book_detail::append(frame, id);
+        remote_book_detail::append(frame, REMOTE_BOOK_OP::GET_NUM_PAGES);
+        frame += bookPath;
+        enqueue(frame);
+        return result;
+    }
+
+    size_t numInFlight()
+    {
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        return m_pending.size();
+    }
+
+    // False once the service has hung up or a send has failed. A closed
+    // connection fails every request, so it has to be replaced.
+    bool isOpen()
+    {
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        return !m_closed;
+    }
+
+private:
+    // Whoever finds no send in progress becomes the sender, and keeps sending
+    // until the outbox is empty. Everyone else just appends and returns, so
+    // requests that arrive during a send are batched into the next one.
+    void enqueue(const std::string &frame)
+    {
+        std::unique_lock<std::mutex> lock(m_outMutex);
+        m_outbox += frame;
+        if (m_sending)
+            return;
+
+        m_sending = true;
+        while (!m_outbox.empty())
+        {
+            std::string batch;
+            batch.swap(m_outbox);
+            lock.unlock();
+            bool sent = remote_book_detail::sendAll(m_fd, batch.data(),
+                batch.size());
+            lock.lock();
+            if (!sent)
+            {
+                m_outbox.clear();
+                shutdown(m_fd, SHUT_RDWR); // The reader fails everything.
+            }
+        }
+        m_sending = false;
+    }
+
+    void readResponses()
+    {
+        std::vector<char> buffer(64 * 1024);
+        size_t used = 0;
+        for (;;)
+        {
+            ssize_t received = recv(m_fd, buffer.data() + used,
+                buffer.size() - used, 0);
+            if (received < 0 && errno == EINTR)
+                continue;
+            if (received <= 0)
+                break;
+            used += static_cast<size_t>(received);
+
+            size_t offset = 0;
+            std::lock_guard<std::mutex> lock(m_pendingMutex);
+            for (; used - offset >= REMOTE_BOOK_RESPONSE_SIZE;
+                offset += REMOTE_BOOK_RESPONSE_SIZE)
+            {
+                const char *response = buffer.data() + offset;
+                auto id = remote_book_detail::read<uint32_t>(response);
+                auto status = remote_book_detail::read<REMOTE_BOOK_STATUS>(
+                    response + 4);
+                auto numPages = remote_book_detail::read<int32_t>(
+                    response + 5);
+
+                auto found = m_pending.find(id);
+                if (found == m_pending.end())
+                    continue;
+                if (status == REMOTE_BOOK_STATUS::OK)
+                    found->second.set_value(numPages);
+                else
+                    found->second.set_exception(std::make_exception_ptr(
+                        std::runtime_error("Parser service failed to parse "
+                            "the book.")));
+                m_pending.erase(found);
+            }
+            std::memmove(buffer.data(), buffer.data() + offset, used - offset);
+            used -= offset;
+        }
+
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        m_closed = true;
+        for (auto &pending : m_pending)
+        {
+            pending.second.set_exception(std::make_exception_ptr(
+                std::runtime_error("Parser service connection closed.")));
+        }
+        m_pending.clear();
+    }
+
+    int m_fd{ -1 };
+    std::thread m_reader;
+
+    std::mutex m_outMutex;
+    std::string m_outbox;
+    bool m_sending{ false };
+
+    std::mutex m_pendingMutex;
+    std::unordered_map<uint32_t, std::promise<int>> m_pending;
+    uint32_t m_nextId{ 0 };
+    bool m_closed{ false };
+};
+
+// A fixed number of connections to one parser service, handed out round
+// robin. A connection the service has closed (for example because it was
+// restarted) is replaced by a new one the next time its slot comes up;
+// callers still holding the old one keep it alive until they are done.
+class RemoteBookParserPool
+{
+public:
+    RemoteBookParserPool(const std::string &socketPath,
+        size_t numConnections = 4)
+        : m_socketPath(socketPath),
+        m_slots(numConnections == 0 ? 1 : numConnections)
+    {
+        for (auto &slot : m_slots)
+        {
+            slot.connection =
+                std::make_shared<RemoteBookParserConnection>(socketPath);
+        }
+    }
+
+    // Throws std::system_error if a closed connection has to be replaced
+    // and the service cannot be reached.
+    std::shared_ptr<RemoteBookParserConnection> connection()
+    {
+        size_t next = m_next.fetch_add(1, std::memory_order_relaxed);
+        Slot &slot = m_slots[next % m_slots.size()];
+        std::lock_guard<std::mutex> lock(slot.mutex);
+        if (!slot.connection->isOpen())
+        {
+            slot.connection =
+                std::make_shared<RemoteBookParserConnection>(m_socketPath);
+        }
+        return slot.connection;
+    }
+
+private:
+    struct Slot
+    {
+        std::mutex mutex;
+        std::shared_ptr<RemoteBookParserConnection> connection;
+    };
+
+    std::string m_socketPath;
+    std::vector<Slot> m_slots;
+    std::atomic<size_t> m_next{ 0 };
+};
+
+class RemoteBookParserProxy : public IBookParser
+{
+public:
+    RemoteBookParserProxy(RemoteBookParserPool &pool, std::string bookPath)
+        : m_pool(pool), m_bookPath(std::move(bookPath)) {}
+
+    int getNumPages() override
+    {
+        TRACE_SCOPE("proxy", "RemoteBookParserProxy::getNumPages");
+        return getNumPagesAsync().get();
+    }
+
+    // Lets a caller keep many requests in flight at once.
+    std::future<int> getNumPagesAsync()
+    {
+        return m_pool.connection()->getNumPagesAsync(m_bookPath);
+    }
+
+private:
+    RemoteBookParserPool &m_pool;
+    std::string m_bookPath;
+};
+
+// A local stand in for the parser service. It can run in its own process
+// (see DesignPatterns --serve) or, for testing, on a background thread of
+// the client's process. Each connection is served by its own thread, which
+// answers every complete request it has received with a single send. Books
+// are parsed through BookParser::create(), so indexed books are answered
+// without a parse.
+class BookParserServer
+{
+public:
+    BookParserServer(const std::string &socketPath)
+        : m_socketPath(socketPath)
+    {
+        sockaddr_un address = remote_book_detail::socketAddress(socketPath);
+        unlink(socketPath.c_str());
+        m_listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (m_listenFd < 0)
+            throw std::system_error(errno, std::system_category(), "socket");
+        if (bind(m_listenFd, reinterpret_cast<sockaddr*>(&address),
+            sizeof(address)) != 0 || listen(m_listenFd, SOMAXCONN) != 0)
+        {
+            int error = errno;
+            close(m_listenFd);
+            throw std::system_error(error, std::system_category(), "bind");
+        }
+        m_acceptor = std::thread([this]() { acceptConnections(); });
+    }
+
+    BookParserServer(const BookParserServer&) = delete;
+    BookParserServer& operator=(const BookParserServer&) = delete;
+
+    ~BookParserServer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+            for (int fd : m_clientFds)
+                shutdown(fd, SHUT_RDWR);
+        }
+        shutdown(m_listenFd, SHUT_RDWR);
+        m_acceptor.join();
+        close(m_listenFd);
+        for (auto &client : m_clients)
+            client.second.join();
+        unlink(m_socketPath.c_str());
+    }
+
+private:
+    void acceptConnections()
+    {
+        for (;;)
+        {
+            int fd = accept(m_listenFd, nullptr, nullptr);
+            if (fd < 0 && errno == EINTR)
+                continue;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (fd < 0 || m_stopping)
+            {
+                if (fd >= 0)
+                    close(fd);
+                return;
+            }
+            reapClients();
+            uint64_t id = m_nextClient++;
+            m_clientFds.push_back(fd);
+            m_clients.emplace(id, std::thread([this, fd, id]()
+            {
+                serve(fd, id);
+            }));
+        }
+    }
+
+    // Joins the threads of connections that have ended, so a long running
+    // service only holds on to about as many threads as it has had clients
+    // at once. Called with m_mutex held; a finished thread has already
+    // released it, so the joins return at once.
+    void reapClients()
+    {
+        for (uint64_t id : m_finished)
+        {
+            auto found = m_clients.find(id);
+            found->second.join();
+            m_clients.erase(found);
+        }
+        m_finished.clear();
+    }
+
+    void serve(int fd, uint64_t id)
+    {
+        // Big enough for the largest frame, so a frame always fits once
+        // everything before it has been consumed.
+        std::vector<char> buffer(REMOTE_BOOK_REQUEST_HEADER +
+            REMOTE_BOOK_MAX_PAYLOAD);
+        std::string responses;
+        size_t used = 0;
+        bool malformed = false;
+        while (!malformed)
+        {
+            ssize_t received = recv(fd, buffer.data() + used,
+                buffer.size() - used, 0);
+            if (received < 0 && errno == EINTR)
+                continue;
+            if (received <= 0)
+                break;
+            used += static_cast<size_t>(received);
+
+            size_t offset = 0;
+            while (used - offset >= REMOTE_BOOK_REQUEST_HEADER)
+            {
+                const char *request = buffer.data() + offset;
+                auto size = remote_book_detail::read<uint32_t>(request);
+                if (size > REMOTE_BOOK_MAX_PAYLOAD)
+                {
+                    malformed = true;
+                    break;
+                }
+                if (used - offset < REMOTE_BOOK_REQUEST_HEADER + size)
+                    break;
+
+                auto id = remote_book_detail::read<uint32_t>(request + 4);
+                auto op = remote_book_detail::read<REMOTE_BOOK_OP>(request + 8);
+                std::string path(request + REMOTE_BOOK_REQUEST_HEADER, size);
+                int32_t numPages = 0;
+                auto status = handle(op, path, numPages);
+                remote_book_detail::append(responses, id);
+                remote_book_detail::append(responses, status);
+                remote_book_detail::append(responses, numPages);
+                offset += REMOTE_BOOK_REQUEST_HEADER + size;
+            }
+            std::memmove(buffer.data(), buffer.data() + offset, used - offset);
+            used -= offset;
+
+            if (!remote_book_detail::sendAll(fd, responses.data(),
+                responses.size()))
+                break;
+            responses.clear();
+        }
+        shutdown(fd, SHUT_RDWR);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto &clientFd : m_clientFds)
+        {
+            if (clientFd == fd)
+            {
+                close(fd);
+                clientFd = m_clientFds.back();
+                m_clientFds.pop_back();
+                break;
+            }
+        }
+        m_finished.push_back(id);
+    }
+
+    REMOTE_BOOK_STATUS handle(REMOTE_BOOK_OP op, const std::string &bookPath,
+        int32_t &numPages)
+    {
+        if (op != REMOTE_BOOK_OP::GET_NUM_PAGES)
+            return REMOTE_BOOK_STATUS::FAILED;
+        try
+        {
+            auto book = BookSource::fromFile(bookPath);
+            numPages = BookParser::create(*book)->getNumPages();
+            return REMOTE_BOOK_STATUS::OK;
+        }
+        catch (const std::exception&)
+        {
+            return REMOTE_BOOK_STATUS::FAILED;
+        }
+    }
+
+    std::string m_socketPath;
+    int m_listenFd{ -1 };
+    std::thread m_acceptor;
+
+    std::mutex m_mutex;
+    bool m_stopping{ false };
+    std::vector<int> m_clientFds;
+    std::unordered_map<uint64_t, std::thread> m_clients;
+    std::vector<uint64_t> m_finished;
+    uint64_t m_nextClient{ 0 };
+};
+
+#endif
@@ -0,0 +1,288 @@
+#pragma once
+// Publishes a WeatherStationObservable's temperature to observers living in
+// other processes, through a small shared memory segment instead of a
+// separate IPC channel per consumer.
+
+// The segment holds a seqlock: the publisher makes the sequence number odd,
+// writes the reading, then makes it even again. Readers copy the reading and
+// retry if the sequence was odd or changed while they were copying. Reading
+// never takes a lock or makes a system call. Subscribers which want to block
+// until the next update sleep on the sequence number with a futex on Linux
+// (and poll elsewhere); the publisher only makes the wake up system call when
+// somebody is actually asleep.
+
+// Shared memory is only set up for POSIX systems, so on Windows this header
+// is empty.
+#ifndef _WIN32
+
+#include "Observer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+struct WeatherReading
+{
+	int temperature;
+	uint64_t sequence;       // Even, and increases with every publish.
+	int64_t publishedAtNs;   // Steady clock, comparable across processes.
+};
+
+struct SharedWeatherSegment
+{
+	static constexpr uint32_t MAGIC = 0x57544852; // "WTHR"
+
+	std::atomic<uint32_t> magic;
+	std::atomic<uint32_t> sequence;
+	std::atomic<uint32_t> sleepers;
+	std::atomic<int32_t> temperature;
+	std::atomic<int64_t> publishedAtNs;
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free &&
+	std::atomic<int64_t>::is_always_lock_free,
+	"Shared memory atomics must be lock free.");
+
+namespace shared_weather_detail
+{
+	inline int64_t nowNs()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	inline SharedWeatherSegment* map(const std::string &name, bool create)
+	{
+		int fd = shm_open(name.c_str(), create ? O_CREAT | O_RDWR : O_RDWR,
+			0600);
+		if (fd < 0)
+			throw std::system_error(errno, std::system_category(), "shm_open");
+		if (create && ftruncate(fd, sizeof(SharedWeatherSegment)) != 0)
+		{
+			int error = errno;
+			close(fd);
+			throw std::system_error(error, std::system_category(), "ftruncate");
+		}
+
+		// A publisher that has created the segment but not sized it yet. Any
+		// access to the mapping would raise SIGBUS.
+		struct stat info;
+		if (!create && (fstat(fd, &info) != 0 ||
+			info.st_size < static_cast<off_t>(sizeof(SharedWeatherSegment))))
+		{
+			close(fd);
+			throw std::runtime_error("Weather segment " + name +
+				" is not ready.");
+		}
+		void *memory = mmap(nullptr, sizeof(SharedWeatherSegment),
+			PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		int error = errno;
+		close(fd);
+		if (memory == MAP_FAILED)
+			throw std::system_error(error, std::system_category(), "mmap");
+		return static_cast<SharedWeatherSegment*>(memory);
+	}
+
+	inline void wait(std::atomic<uint32_t> &word, uint32_t value,
+		std::chrono::nanoseconds timeout)
+	{
+#ifdef __linux__
+		timespec time;
+		time.tv_sec = static_cast<time_t>(timeout.count() / 1000000000);
+		time.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT,
+			value, &time, nullptr, 0);
+#else
+		(void)word;
+		(void)value;
+		std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(
+			timeout, std::chrono::microseconds(100)));
+#endif
+	}
+
+	inline void wakeAll(std::atomic<uint32_t> &word)
+	{
+#ifdef __linux__
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE,
+			INT_MAX, nullptr, nullptr, 0);
+#else
+		(void)word;
+#endif
+	}
+}
+
+// Observes a WeatherStationObservable and publishes every temperature it is
+// notified about into the named segment (e.g. "/weather"). There must be only
+// one publisher per segment. The segment is removed when the publisher goes.
+class SharedWeatherPublisher : public IObserver
+{
+public:
+	SharedWeatherPublisher(const std::string &name,
+		WeatherStationObservable &wso)
+		: m_name(name), wso(wso),
+		m_segment(shared_weather_detail::map(name, true))
+	{
+		publish(wso.getTemperature());
+		m_segment->magic.store(SharedWeatherSegment::MAGIC,
+			std::memory_order_release);
+	}
+
+	SharedWeatherPublisher(const SharedWeatherPublisher&) = delete;
+	SharedWeatherPublisher& operator=(const SharedWeatherPublisher&) = delete;
+
+	~SharedWeatherPublisher()
+	{
+		munmap(m_segment, sizeof(SharedWeatherSegment));
+		shm_unlink(m_name.c_str());
+	}
+
+	void update() const override
+	{
+		publish(wso.getTemperature());
+	}
+
+	void publish(int temperature) const
+	{
+		uint32_t sequence = m_segment->sequence.load(std::memory_order_relaxed);
+		m_segment->sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		m_segment->temperature.store(temperature, std::memory_order_relaxed);
+		m_segment->publishedAtNs.store(shared_weather_detail::nowNs(),
+			std::memory_order_relaxed);
+		m_segment->sequence.store(sequence + 2, std::memory_order_seq_cst);
+
+		// Pairs with the seq_cst increment of sleepers in waitForUpdate, so
+		// either the sleeper sees the new sequence or we see the sleeper.
+		if (m_segment->sleepers.load(std::memory_order_seq_cst) != 0)
+			shared_weather_detail::wakeAll(m_segment->sequence);
+	}
+
+private:
+	std::string m_name;
+	WeatherStationObservable &wso;
+	SharedWeatherSegment *m_segment;
+};
+
+// Reads the temperature published by a SharedWeatherPublisher, usually from
+// another process.
+class SharedWeatherSubscriber
+{
+public:
+	SharedWeatherSubscriber(const std::string &name)
+		: m_segment(shared_weather_detail::map(name, false))
+	{
+		if (m_segment->magic.load(std::memory_order_acquire) !=
+			SharedWeatherSegment::MAGIC)
+		{
+			munmap(m_segment, sizeof(SharedWeatherSegment));
+			throw std::runtime_error("Weather segment " + name +
+				" is not ready.");
+		}
+	}
+
+	SharedWeatherSubscriber(const SharedWeatherSubscriber&) = delete;
+	SharedWeatherSubscriber& operator=(const SharedWeatherSubscriber&) = delete;
+
+	~SharedWeatherSubscriber()
+	{
+		munmap(m_segment, sizeof(SharedWeatherSegment));
+	}
+
+	WeatherReading read() const
+	{
+		for (;;)
+		{
+			uint32_t before = m_segment->sequence.load(
+				std::memory_order_acquire);
+			if (before & 1)
+				continue;
+			WeatherReading reading;
+			reading.temperature = m_segment->temperature.load(
+				std::memory_order_relaxed);
+			reading.publishedAtNs = m_segment->publishedAtNs.load(
+				std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (m_segment->sequence.load(std::memory_order_relaxed) == before)
+			{
+				reading.sequence = before;
+				return reading;
+			}
+		}
+	}
+
+	// Returns true and fills in reading if anything was published since the
+	// last reading this subscriber returned.
+	bool poll(WeatherReading &reading)
+	{
+		if (m_segment->sequence.load(std::memory_order_acquire) == m_lastSeen)
+			return false;
+		reading = read();
+		m_lastSeen = static_cast<uint32_t>(reading.sequence);
+		return true;
+	}
+
+	// Like poll, but waits up to timeout for the next publish. Spins briefly
+	// first, since updates often arrive within microseconds.
+	bool waitForUpdate(WeatherReading &reading,
+		std::chrono::nanoseconds timeout)
+	{
+		for (int spin = 0; spin < 1000; ++spin)
+		{
+			if (poll(reading))
+				return true;
+		}
+
+		auto deadline = std::chrono::steady_clock::now() + timeout;
+		for (;;)
+		{
+			auto left = deadline - std::chrono::steady_clock::now();
+			if (left <= std::chrono::nanoseconds::zero())
+				return poll(reading);
+
+			m_segment->sleepers.fetch_add(1, std::memory_order_seq_cst);
+			uint32_t sequence = m_segment->sequence.load(
+				std::memory_order_seq_cst);
+			if (sequence == m_lastSeen)
+				shared_weather_detail::wait(m_segment->sequence, sequence, left);
+			m_segment->sleepers.fetch_sub(1, std::memory_order_relaxed);
+
+			if (poll(reading))
+				return true;
+		}
+	}
+
+	// Passes any new temperature on to a local observable, so the usual
+	// observers can be used in the subscribing process too.
+	bool forwardTo(WeatherStationObservable &local)
+	{
+		WeatherReading reading;
+		if (!poll(reading))
+			return false;
+		if (reading.temperature != local.getTemperature())
+			local.setTemperature(reading.temperature);
+		return true;
+	}
+
+private:
+	SharedWeatherSegment *m_segment;
+	uint32_t m_lastSeen{ 0 };
+};
+
+#endif
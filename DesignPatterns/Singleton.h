@@ -1,28 +1,310 @@
 #pragma once
 // The singleton pattern ensures a class has only one instance and provides
 // a global point of access to it.
-#include <iostream>:
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <iostream>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 class Singleton
 {
 public:
+    // C++11 guarantees a function local static is initialized exactly once,
+    // even when several threads get here at the same time.
     static Singleton* getInstance()
     {
-        if (!instance)
-            instance = std::make_unique<Singleton>();
-        return instance.get();
+        static Singleton instance;
+        return &instance;
     }
 
     void printAddress()
     {
-        std::cout << "The address of this instance is. " << instance.get()
-            << std::endl;
+        std::cout << "The address of this instance is. " << this << std::endl;
     }
 
 private:
-    Singleton();
-    static std::unique_ptr<Singleton> instance;
+    Singleton() {}
 };
 
 // Very basic pattern, so no example.
+
+// A process with dozens of singletons can spend most of its startup building
+// them one after the other. The registry instead builds them all up front,
+// each one as soon as the singletons it depends on exist, so independent
+// singletons are built in parallel.
+
+// Usage:
+//   SingletonRegistry::instance().add<Config>("Config", {});
+//   SingletonRegistry::instance().add<Database>("Database", { "Config" });
+//   SingletonRegistry::instance().initializeAll();
+//   RegisteredSingleton<Database>::get().query(...);
+
+class SingletonRegistry;
+
+// Access to a registered singleton is a single load of its instance pointer.
+// get() must only be called once the registry has built the singleton, and
+// not after the registry is destroyed.
+template <typename T>
+class RegisteredSingleton
+{
+public:
+    static T& get()
+    {
+        return *s_instance.load(std::memory_order_acquire);
+    }
+
+    static bool isInitialized()
+    {
+        return s_instance.load(std::memory_order_acquire) != nullptr;
+    }
+
+private:
+    friend class SingletonRegistry;
+    static inline std::atomic<T*> s_instance{ nullptr };
+    static inline std::atomic<SingletonRegistry*> s_registry{ nullptr };
+};
+
+class SingletonRegistry
+{
+public:
+    // The process wide registry. Separate registries can be created, e.g. to
+    // measure startup, but a type can only be registered with one of them at
+    // a time.
+    static SingletonRegistry& instance()
+    {
+        static SingletonRegistry registry;
+        return registry;
+    }
+
+    SingletonRegistry() = default;
+    SingletonRegistry(const SingletonRegistry&) = delete;
+    SingletonRegistry& operator=(const SingletonRegistry&) = delete;
+
+    // Singletons are destroyed in the reverse order they were built, so none
+    // outlives a singleton it depends on. Each one's instance pointer is
+    // cleared just before it goes, and afterwards every type registered here
+    // can be registered again.
+    ~SingletonRegistry()
+    {
+        while (!m_owned.empty())
+        {
+            m_nodes[m_owned.back().node].release();
+            m_owned.pop_back();
+        }
+        for (auto &node : m_nodes)
+            node.release();
+    }
+
+    // Registers T under name, to be built by factory once every singleton
+    // named in dependencies has been built. Throws if T is already registered,
+    // with this or any other live registry.
+    template <typename T>
+    void add(const std::string &name, std::vector<std::string> dependencies,
+        std::function<std::unique_ptr<T>()> factory)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_started)
+            throw std::logic_error("Singletons are already initialized.");
+        if (m_index.count(name) != 0)
+            throw std::logic_error("Singleton " + name + " added twice.");
+        SingletonRegistry *owner = nullptr;
+        if (!RegisteredSingleton<T>::s_registry.compare_exchange_strong(owner,
+            this, std::memory_order_acq_rel))
+        {
+            throw std::logic_error("The type of singleton " + name +
+                " is already registered.");
+        }
+
+        Node node;
+        node.name = name;
+        node.dependencies = std::move(dependencies);
+        node.create = [factory]() -> std::shared_ptr<void>
+        {
+            std::shared_ptr<T> instance = factory();
+            RegisteredSingleton<T>::s_instance.store(instance.get(),
+                std::memory_order_release);
+            return instance;
+        };
+        node.release = []()
+        {
+            RegisteredSingleton<T>::s_instance.store(nullptr,
+                std::memory_order_release);
+            RegisteredSingleton<T>::s_registry.store(nullptr,
+                std::memory_order_release);
+        };
+        m_index[name] = m_nodes.size();
+        m_nodes.push_back(std::move(node));
+    }
+
+    template <typename T>
+    void add(const std::string &name, std::vector<std::string> dependencies)
+    {
+        add<T>(name, std::move(dependencies),
+            []() { return std::make_unique<T>(); });
+    }
+
+    // Builds every registered singleton using up to numThreads threads (0
+    // uses every hardware thread). Throws if a dependency is missing or
+    // dependencies form a cycle, before anything is built. If a factory
+    // throws, the first exception is rethrown once running factories finish.
+    void initializeAll(unsigned numThreads = 0)
+    {
+        std::lock_guard<std::mutex> initLock(m_initMutex);
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_started)
+        {
+            if (m_error)
+                std::rethrow_exception(m_error);
+            return;
+        }
+        checkGraph();
+        m_started = true;
+
+        m_ready.clear();
+        for (size_t i = 0; i < m_nodes.size(); ++i)
+        {
+            m_nodes[i].waitingOn = m_nodes[i].dependencies.size();
+            if (m_nodes[i].waitingOn == 0)
+                m_ready.push_back(i);
+        }
+        m_remaining = m_nodes.size();
+
+        if (numThreads == 0)
+            numThreads = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> workers;
+        lock.unlock();
+        for (unsigned i = 1; i < numThreads; ++i)
+            workers.emplace_back([this]() { runWorker(); });
+        runWorker();
+        for (auto &worker : workers)
+            worker.join();
+        lock.lock();
+
+        if (m_error)
+            std::rethrow_exception(m_error);
+    }
+
+private:
+    struct Node
+    {
+        std::string name;
+        std::vector<std::string> dependencies;
+        std::vector<size_t> dependants;
+        std::function<std::shared_ptr<void>()> create;
+        std::function<void()> release;
+        size_t waitingOn{ 0 };
+    };
+
+    struct Owned
+    {
+        std::shared_ptr<void> instance;
+        size_t node;
+    };
+
+    // Kahn's algorithm on a copy of the in-degrees, so a bad graph is
+    // reported before any factory runs.
+    void checkGraph()
+    {
+        for (auto &node : m_nodes)
+            node.dependants.clear();
+        std::vector<size_t> inDegree(m_nodes.size());
+        for (size_t i = 0; i < m_nodes.size(); ++i)
+        {
+            for (auto &dependency : m_nodes[i].dependencies)
+            {
+                auto found = m_index.find(dependency);
+                if (found == m_index.end())
+                {
+                    throw std::logic_error("Singleton " + m_nodes[i].name +
+                        " depends on unknown singleton " + dependency + ".");
+                }
+                m_nodes[found->second].dependants.push_back(i);
+                ++inDegree[i];
+            }
+        }
+
+        std::vector<size_t> ready;
+        for (size_t i = 0; i < m_nodes.size(); ++i)
+        {
+            if (inDegree[i] == 0)
+                ready.push_back(i);
+        }
+        size_t visited = 0;
+        while (!ready.empty())
+        {
+            size_t next = ready.back();
+            ready.pop_back();
+            ++visited;
+            for (size_t dependant : m_nodes[next].dependants)
+            {
+                if (--inDegree[dependant] == 0)
+                    ready.push_back(dependant);
+            }
+        }
+        if (visited != m_nodes.size())
+            throw std::logic_error("Singleton dependencies form a cycle.");
+    }
+
+    void runWorker()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;)
+        {
+            m_wake.wait(lock, [this]() {
+                return !m_ready.empty() || m_remaining == 0 || m_error; });
+            if (m_remaining == 0 || m_error)
+                return;
+
+            size_t next = m_ready.back();
+            m_ready.pop_back();
+            lock.unlock();
+            std::exception_ptr error;
+            std::shared_ptr<void> instance;
+            try
+            {
+                instance = m_nodes[next].create();
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            lock.lock();
+
+            if (error)
+            {
+                if (!m_error)
+                    m_error = error;
+                m_wake.notify_all();
+                return;
+            }
+            m_owned.push_back({ std::move(instance), next });
+            --m_remaining;
+            for (size_t dependant : m_nodes[next].dependants)
+            {
+                if (--m_nodes[dependant].waitingOn == 0)
+                    m_ready.push_back(dependant);
+            }
+            m_wake.notify_all();
+        }
+    }
+
+    std::mutex m_initMutex;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::vector<Node> m_nodes;
+    std::unordered_map<std::string, size_t> m_index;
+    std::vector<size_t> m_ready;
+    size_t m_remaining{ 0 };
+    std::exception_ptr m_error;
+    bool m_started{ false };
+    std::vector<Owned> m_owned; // In the order built.
+};
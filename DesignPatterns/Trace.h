@@ -0,0 +1,463 @@
+#pragma once
+// Scoped trace points for the patterns' hot paths. A trace point times the
+// rest of the scope it is declared in:
+//
+//   void notify() override
+//   {
+//       TRACE_SCOPE("observer", "WeatherStationObservable::notify");
+//       ...
+//   }
+//
+// Trace points are compiled out completely unless DESIGNPATTERNS_TRACING is
+// defined (the CMake option of the same name). When compiled in, tracing can
+// still be switched off at runtime with Tracer::setEnabled(false), leaving a
+// single relaxed load per scope.
+
+// Each trace point keeps a call count and a latency histogram, which can be
+// read at any time with Tracer::stats(). Each thread also records its most
+// recent scopes in its own ring buffer, and Tracer::writeChromeTrace() dumps
+// them in the Chrome trace event format, for chrome://tracing or Perfetto.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#define DESIGNPATTERNS_TRACE_TSC
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+// Reading the clock twice is most of the cost of a trace point, so on x86 it
+// reads the time stamp counter, which costs a fraction of
+// steady_clock::now(). Ticks are converted to steady clock nanoseconds using
+// a calibration that takes 10 ms. When trace points are compiled in it is
+// taken at startup, and Tracer::setEnabled(true) takes it if it has not been
+// taken yet, so a traced call never waits for it. This assumes an invariant
+// TSC, which every x86 CPU of the last decade has.
+class TraceClock
+{
+public:
+    static uint64_t ticks()
+    {
+#ifdef DESIGNPATTERNS_TRACE_TSC
+        return __rdtsc();
+#else
+        return steadyNs();
+#endif
+    }
+
+    static uint64_t toDurationNs(uint64_t ticks)
+    {
+        return uint64_t(double(ticks) * calibration().nsPerTick);
+    }
+
+    static uint64_t fromDurationNs(uint64_t ns)
+    {
+        return uint64_t(double(ns) / calibration().nsPerTick);
+    }
+
+    static uint64_t toNs(uint64_t ticks)
+    {
+        const Calibration &c = calibration();
+        return c.baseNs + uint64_t(double(int64_t(ticks - c.baseTicks)) *
+            c.nsPerTick);
+    }
+
+    // Takes the calibration now, unless it has been taken already. Otherwise
+    // the first conversion takes it.
+    static void calibrate()
+    {
+        calibration();
+    }
+
+private:
+    struct Calibration
+    {
+        uint64_t baseTicks;
+        uint64_t baseNs;
+        double nsPerTick;
+    };
+
+    static uint64_t steadyNs()
+    {
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    static const Calibration& calibration()
+    {
+        static const Calibration calibration = []()
+        {
+            Calibration c{ ticks(), steadyNs(), 1.0 };
+#ifdef DESIGNPATTERNS_TRACE_TSC
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            uint64_t endTicks = ticks();
+            uint64_t endNs = steadyNs();
+            if (endTicks > c.baseTicks)
+            {
+                c.nsPerTick = double(endNs - c.baseNs) /
+                    double(endTicks - c.baseTicks);
+            }
+#endif
+            return c;
+        }();
+        return calibration;
+    }
+};
+
+class TracePoint
+{
+public:
+    // 64 power of two buckets, bucket i holds durations in [2^(i-1), 2^i) ns.
+    static constexpr size_t NUM_BUCKETS = 64;
+
+    TracePoint(const char *category, const char *name);
+
+    TracePoint(const TracePoint&) = delete;
+    TracePoint& operator=(const TracePoint&) = delete;
+
+    const char* category() const { return m_category; }
+    const char* name() const { return m_name; }
+
+    void record(uint64_t durationNs)
+    {
+        m_totalNs.fetch_add(durationNs, std::memory_order_relaxed);
+        m_buckets[bucketFor(durationNs)].fetch_add(1,
+            std::memory_order_relaxed);
+    }
+
+    static size_t bucketFor(uint64_t durationNs)
+    {
+        size_t bucket = 0;
+        while (durationNs != 0 && bucket < NUM_BUCKETS - 1)
+        {
+            durationNs >>= 1;
+            ++bucket;
+        }
+        return bucket;
+    }
+
+private:
+    friend class Tracer;
+
+    const char *m_category;
+    const char *m_name;
+    std::atomic<uint64_t> m_totalNs{ 0 };
+    std::array<std::atomic<uint64_t>, NUM_BUCKETS> m_buckets{};
+};
+
+struct TracePointStats
+{
+    std::string category;
+    std::string name;
+    uint64_t count{ 0 };
+    uint64_t totalNs{ 0 };
+    std::array<uint64_t, TracePoint::NUM_BUCKETS> buckets{};
+
+    double meanNs() const
+    {
+        return count == 0 ? 0.0 : double(totalNs) / double(count);
+    }
+
+    // Upper bound of the bucket holding the given percentile, e.g. 99.0.
+    uint64_t percentileNs(double percentile) const
+    {
+        uint64_t target = uint64_t(double(count) * percentile / 100.0);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < buckets.size(); ++i)
+        {
+            seen += buckets[i];
+            if (seen > target || (seen == count && seen != 0))
+                return i == 0 ? 0 : (uint64_t(1) << i) - 1;
+        }
+        return 0;
+    }
+};
+
+class Tracer
+{
+public:
+    // Events kept per thread. Older events are overwritten.
+    static constexpr size_t RING_SIZE = 1 << 14;
+
+    static void setEnabled(bool enabled)
+    {
+        if (enabled)
+            TraceClock::calibrate();
+        s_enabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    static bool isEnabled()
+    {
+        return s_enabled.load(std::memory_order_relaxed);
+    }
+
+    // Takes TraceClock ticks.
+    static void record(TracePoint &point, uint64_t start, uint64_t end)
+    {
+        uint64_t durationNs = TraceClock::toDurationNs(end - start);
+        point.record(durationNs);
+
+        Ring &ring = ringForThisThread();
+        uint64_t head = ring.head.load(std::memory_order_relaxed);
+        Event &event = ring.events[head & (RING_SIZE - 1)];
+        // Pairs with the fence in writeChromeTrace(), which then sees this
+        // event's slot as overwritten if it read any of the new values.
+        std::atomic_thread_fence(std::memory_order_release);
+        event.point.store(&point, std::memory_order_relaxed);
+        event.start.store(start, std::memory_order_relaxed);
+        event.durationNs.store(durationNs, std::memory_order_relaxed);
+        ring.head.store(head + 1, std::memory_order_release);
+    }
+
+    // The counters and histograms of every trace point reached so far.
+    static std::vector<TracePointStats> stats()
+    {
+        std::vector<TracePointStats> result;
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        for (TracePoint *point : registry().points)
+        {
+            TracePointStats stats;
+            stats.category = point->category();
+            stats.name = point->name();
+            for (size_t i = 0; i < TracePoint::NUM_BUCKETS; ++i)
+            {
+                stats.buckets[i] =
+                    point->m_buckets[i].load(std::memory_order_relaxed);
+                stats.count += stats.buckets[i];
+            }
+            stats.totalNs = point->m_totalNs.load(std::memory_order_relaxed);
+            result.push_back(std::move(stats));
+        }
+        return result;
+    }
+
+    // Zeroes every counter and forgets every recorded event.
+    static void reset()
+    {
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        for (TracePoint *point : registry().points)
+        {
+            point->m_totalNs = 0;
+            for (auto &bucket : point->m_buckets)
+                bucket = 0;
+        }
+        for (auto &ring : registry().rings)
+            ring->dumpFrom = ring->head.load(std::memory_order_acquire);
+    }
+
+    // Writes the events still held in every thread's ring in the Chrome trace
+    // event format. Safe to call while other threads are tracing, events
+    // overwritten during the dump are left out.
+    static void writeChromeTrace(std::ostream &out)
+    {
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        bool first = true;
+        for (auto &ring : registry().rings)
+        {
+            uint64_t head = ring->head.load(std::memory_order_acquire);
+            uint64_t begin = std::max(ring->dumpFrom,
+                head > RING_SIZE ? head - RING_SIZE : 0);
+            std::vector<std::pair<uint64_t, EventCopy>> copies;
+            for (uint64_t i = begin; i < head; ++i)
+            {
+                const Event &event = ring->events[i & (RING_SIZE - 1)];
+                EventCopy copy{ event.point.load(std::memory_order_relaxed),
+                    TraceClock::toNs(
+                        event.start.load(std::memory_order_relaxed)),
+                    event.durationNs.load(std::memory_order_relaxed) };
+                copies.emplace_back(i, copy);
+            }
+
+            // Drops anything the thread overwrote, or was overwriting, while
+            // it was copied.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t newHead = ring->head.load(std::memory_order_relaxed);
+            uint64_t valid = newHead >= RING_SIZE ?
+                newHead - RING_SIZE + 1 : 0;
+            for (auto &copy : copies)
+            {
+                if (copy.first < valid)
+                    continue;
+                const EventCopy &event = copy.second;
+                out << (first ? "\n" : ",\n") << "{\"name\":\""
+                    << event.point->name() << "\",\"cat\":\""
+                    << event.point->category()
+                    << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring->threadId
+                    << ",\"ts\":" << event.startNs / 1000 << '.'
+                    << threeDigits(event.startNs % 1000)
+                    << ",\"dur\":" << event.durationNs / 1000 << '.'
+                    << threeDigits(event.durationNs % 1000) << "}";
+                first = false;
+            }
+        }
+        out << "\n]}\n";
+    }
+
+    static bool writeChromeTrace(const std::string &path)
+    {
+        std::ofstream out(path);
+        writeChromeTrace(out);
+        return static_cast<bool>(out);
+    }
+
+private:
+    friend class TracePoint;
+
+    struct Event
+    {
+        std::atomic<TracePoint*> point{ nullptr };
+        std::atomic<uint64_t> start{ 0 };
+        std::atomic<uint64_t> durationNs{ 0 };
+    };
+
+    struct EventCopy
+    {
+        TracePoint *point;
+        uint64_t startNs;
+        uint64_t durationNs;
+    };
+
+    // Written only by the thread using it. When that thread exits the ring
+    // is kept, so its events still show up in the dump, and handed to the
+    // next new thread, so short lived threads do not add up.
+    struct Ring
+    {
+        std::unique_ptr<Event[]> events{ new Event[RING_SIZE] };
+        std::atomic<uint64_t> head{ 0 };
+        uint64_t dumpFrom{ 0 };
+        uint32_t threadId{ 0 };
+    };
+
+    struct Registry
+    {
+        std::mutex mutex;
+        std::vector<TracePoint*> points;
+        std::vector<std::unique_ptr<Ring>> rings;
+        std::vector<Ring*> unused;
+    };
+
+    struct RingHandle
+    {
+        Ring *ring{ nullptr };
+
+        ~RingHandle()
+        {
+            if (ring == nullptr)
+                return;
+            std::lock_guard<std::mutex> lock(registry().mutex);
+            registry().unused.push_back(ring);
+        }
+    };
+
+    static Registry& registry()
+    {
+        // Never destroyed, trace points may still fire during static
+        // destruction.
+        static Registry *registry = new Registry();
+        return *registry;
+    }
+
+    static Ring& ringForThisThread()
+    {
+        thread_local RingHandle handle;
+        if (handle.ring == nullptr)
+        {
+            std::lock_guard<std::mutex> lock(registry().mutex);
+            if (!registry().unused.empty())
+            {
+                handle.ring = registry().unused.back();
+                registry().unused.pop_back();
+            }
+            else
+            {
+                auto created = std::make_unique<Ring>();
+                created->threadId = uint32_t(registry().rings.size() + 1);
+                handle.ring = created.get();
+                registry().rings.push_back(std::move(created));
+            }
+        }
+        return *handle.ring;
+    }
+
+    struct ThreeDigits
+    {
+        uint64_t value;
+    };
+
+    static ThreeDigits threeDigits(uint64_t value)
+    {
+        return { value };
+    }
+
+    friend std::ostream& operator<<(std::ostream &out, ThreeDigits digits)
+    {
+        return out << char('0' + digits.value / 100)
+            << char('0' + digits.value / 10 % 10)
+            << char('0' + digits.value % 10);
+    }
+
+    static inline std::atomic<bool> s_enabled{ true };
+};
+
+inline TracePoint::TracePoint(const char *category, const char *name)
+    : m_category(category), m_name(name)
+{
+    std::lock_guard<std::mutex> lock(Tracer::registry().mutex);
+    Tracer::registry().points.push_back(this);
+}
+
+class TraceScope
+{
+public:
+    TraceScope(TracePoint &point)
+        : m_point(Tracer::isEnabled() ? &point : nullptr),
+        m_start(m_point != nullptr ? TraceClock::ticks() : 0) {}
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+    ~TraceScope()
+    {
+        if (m_point != nullptr)
+            Tracer::record(*m_point, m_start, TraceClock::ticks());
+    }
+
+private:
+    TracePoint *m_point;
+    uint64_t m_start;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#ifdef DESIGNPATTERNS_TRACING
+// Tracing starts out enabled, so calibrate during static initialization
+// rather than in the first traced call.
+namespace trace_detail
+{
+    inline const bool clockCalibrated = (TraceClock::calibrate(), true);
+}
+
+#define TRACE_SCOPE(category, name) \
+    static TracePoint TRACE_CONCAT(tracePoint_, __LINE__)(category, name); \
+    TraceScope TRACE_CONCAT(traceScope_, __LINE__)( \
+        TRACE_CONCAT(tracePoint_, __LINE__))
+#else
+#define TRACE_SCOPE(category, name) ((void)0)
+#endif
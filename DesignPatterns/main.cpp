@@ -6,6 +6,50 @@
 #include "Command.h"
 #include "Proxy.h"
 #include "Bridge.h"
+#include "Trace.h"
+#include "LoadDriver.h"
+#include "RemoteProxy.h"
+
+#ifndef _WIN32
+#include <csignal>
+#endif
+
+void printUsage()
+{
+    std::cout << "Usage: DesignPatterns [--workload <spec>]... "
+        << "[--script <file>]..." << std::endl;
+    std::cout << "       DesignPatterns --serve <socket>" << std::endl;
+    std::cout << "Without options the demos run interactively. "
+        << "See LoadDriver.h for the workload format." << std::endl;
+    std::cout << "--serve runs a book parser service for "
+        << "RemoteBookParserProxy until interrupted." << std::endl;
+}
+
+#ifndef _WIN32
+int serveBookParser(const std::string &socketPath)
+{
+    // Blocked before the server starts its threads, so that they inherit
+    // the mask and the signals are only taken by sigwait below.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    try
+    {
+        BookParserServer server(socketPath);
+        std::cout << "Serving books on " << socketPath << std::endl;
+        int signal = 0;
+        sigwait(&signals, &signal);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+#endif
 
 void printOptions()
 {
@@ -20,8 +64,48 @@ void printOptions()
     std::cout << "0. Exit" << std::endl;
 }
 
-int main()
+int main(int argc, char **argv)
 {
+#ifndef _WIN32
+    if (argc == 3 && std::string(argv[1]) == "--serve")
+        return serveBookParser(argv[2]);
+#endif
+    if (argc > 1)
+    {
+        // Headless: run the given workloads instead of the menu.
+        std::vector<std::string> workloads;
+        try
+        {
+            for (int i = 1; i < argc; ++i)
+            {
+                std::string arg = argv[i];
+                if (arg == "--workload" && i + 1 < argc)
+                    workloads.push_back(argv[++i]);
+                else if (arg == "--script" && i + 1 < argc)
+                {
+                    auto script = readLoadScript(argv[++i]);
+                    workloads.insert(workloads.end(), script.begin(),
+                        script.end());
+                }
+                else
+                {
+                    printUsage();
+                    return arg == "--help" ? 0 : 1;
+                }
+            }
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        int result = runLoadDriver(workloads);
+#ifdef DESIGNPATTERNS_TRACING
+        Tracer::writeChromeTrace("DesignPatterns.trace.json");
+#endif
+        return result;
+    }
+
     int decision = 0;
     std::cout << "Note that Singleton, Facade, and " <<
         "Adapter patterns have no demos." << std::endl;
@@ -57,4 +141,9 @@ int main()
         }
         std::cout << std::endl;
     } while (decision != 0);
+
+#ifdef DESIGNPATTERNS_TRACING
+    // Open in chrome://tracing or https://ui.perfetto.dev.
+    Tracer::writeChromeTrace("DesignPatterns.trace.json");
+#endif
 }
\ No newline at end of file